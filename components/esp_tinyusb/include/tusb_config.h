@@ -67,6 +67,14 @@ extern "C" {
 #   define CONFIG_TINYUSB_NET_MODE_NCM 0
 #endif
 
+#ifndef CONFIG_TINYUSB_NCM_XMIT_SG
+#   define CONFIG_TINYUSB_NCM_XMIT_SG 0
+#endif
+
+#ifndef CONFIG_TINYUSB_NCM_CRC
+#   define CONFIG_TINYUSB_NCM_CRC 0
+#endif
+
 #ifndef CONFIG_TINYUSB_DFU_MODE_DFU
 #   define CONFIG_TINYUSB_DFU_MODE_DFU 0
 #endif
@@ -182,6 +190,16 @@ extern "C" {
 #define CFG_TUD_NCM_IN_NTB_N          CONFIG_TINYUSB_NCM_IN_NTB_BUFFS_COUNT
 #define CFG_TUD_NCM_OUT_NTB_MAX_SIZE  CONFIG_TINYUSB_NCM_OUT_NTB_BUFF_MAX_SIZE
 #define CFG_TUD_NCM_IN_NTB_MAX_SIZE   CONFIG_TINYUSB_NCM_IN_NTB_BUFF_MAX_SIZE
+#define CFG_TUD_NCM_XMIT_SG           CONFIG_TINYUSB_NCM_XMIT_SG
+#define CFG_TUD_NCM_CRC               CONFIG_TINYUSB_NCM_CRC
+
+// ECM/RNDIS NET Mode packet buffers configuration
+#define CFG_TUD_ECM_RNDIS_OUT_BUF_N   CONFIG_TINYUSB_ECM_RNDIS_OUT_BUFFS_COUNT
+#define CFG_TUD_ECM_RNDIS_IN_BUF_N    CONFIG_TINYUSB_ECM_RNDIS_IN_BUFFS_COUNT
+#define CFG_TUD_RNDIS_MAX_PACKETS_PER_XFER CONFIG_TINYUSB_RNDIS_MAX_PACKETS_PER_XFER
+
+// ECM/NCM/RNDIS multicast filters
+#define CFG_TUD_NET_MC_FILTER_N       CONFIG_TINYUSB_NET_MC_FILTERS
 
 #ifdef __cplusplus
 }
@@ -49,10 +49,20 @@
 #define RNDIS_MAJOR_VERSION	1
 #define RNDIS_MINOR_VERSION 0
 
+/* PacketAlignmentFactor of multi-packet transfers: every REMOTE_NDIS_PACKET_MSG of a transfer starts
+   on a multiple of 2^factor bytes, the MessageLength of the previous one includes the padding */
+#define RNDIS_PACKET_ALIGNMENT_FACTOR 3
+#define RNDIS_PACKET_ALIGNMENT        (1u << RNDIS_PACKET_ALIGNMENT_FACTOR)
+
+/* largest RNDIS control message in either direction, the OID_GEN_SUPPORTED_LIST query completion;
+   checked against the OID list in rndis_reports.c */
+#define RNDIS_CONTROL_SIZE 192
+
 #define RNDIS_STATUS_SUCCESS            0X00000000
 #define RNDIS_STATUS_FAILURE            0XC0000001
 #define RNDIS_STATUS_INVALID_DATA       0XC0010015
 #define RNDIS_STATUS_NOT_SUPPORTED      0XC00000BB
+#define RNDIS_STATUS_MULTICAST_FULL     0XC0010009
 #define RNDIS_STATUS_MEDIA_CONNECT      0X4001000B
 #define RNDIS_STATUS_MEDIA_DISCONNECT   0X4001000C
 
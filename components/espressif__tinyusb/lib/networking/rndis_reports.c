@@ -39,8 +39,11 @@
 static const uint8_t *const station_hwaddr = tud_network_mac_address;
 static const uint8_t *const permanent_hwaddr = tud_network_mac_address;
 
-static usb_eth_stat_t usb_eth_stat = { 0, 0, 0, 0 };
 static uint32_t oid_packet_filter = 0x0000000;
+#if CFG_TUD_NET_MC_FILTER_N
+static uint8_t oid_mc_list[6 * CFG_TUD_NET_MC_FILTER_N];
+static uint16_t oid_mc_count;
+#endif
 static rndis_state_t rndis_state;
 
 static const uint32_t OIDSupportedList[] =
@@ -66,13 +69,34 @@ static const uint32_t OIDSupportedList[] =
   OID_802_3_CURRENT_ADDRESS,
   OID_802_3_MULTICAST_LIST,
   OID_802_3_MAXIMUM_LIST_SIZE,
-  OID_802_3_MAC_OPTIONS
+  OID_802_3_MAC_OPTIONS,
+  OID_GEN_XMIT_OK,
+  OID_GEN_RCV_OK,
+  OID_GEN_XMIT_ERROR,
+  OID_GEN_RCV_ERROR,
+  OID_GEN_RCV_NO_BUFFER,
+  OID_GEN_DIRECTED_BYTES_XMIT,
+  OID_GEN_DIRECTED_FRAMES_XMIT,
+  OID_GEN_MULTICAST_BYTES_XMIT,
+  OID_GEN_MULTICAST_FRAMES_XMIT,
+  OID_GEN_BROADCAST_BYTES_XMIT,
+  OID_GEN_BROADCAST_FRAMES_XMIT,
+  OID_GEN_DIRECTED_BYTES_RCV,
+  OID_GEN_DIRECTED_FRAMES_RCV,
+  OID_GEN_MULTICAST_BYTES_RCV,
+  OID_GEN_MULTICAST_FRAMES_RCV,
+  OID_GEN_BROADCAST_BYTES_RCV,
+  OID_GEN_BROADCAST_FRAMES_RCV
 };
 
 #define OID_LIST_LENGTH TU_ARRAY_SIZE(OIDSupportedList)
 #define ENC_BUF_SIZE    (OID_LIST_LENGTH * 4 + 32)
 
+TU_VERIFY_STATIC(ENC_BUF_SIZE <= RNDIS_CONTROL_SIZE, "RNDIS_CONTROL_SIZE too small for the OID list");
+TU_VERIFY_STATIC(sizeof(rndis_set_msg_t) + 6 * CFG_TUD_NET_MC_FILTER_N <= RNDIS_CONTROL_SIZE, "RNDIS_CONTROL_SIZE too small for the multicast list");
+
 static void *encapsulated_buffer;
+static uint32_t encapsulated_length; /* bytes of the message received in encapsulated_buffer */
 
 static void rndis_report(void) {
   uint8_t ndis_report[8] = { 0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00 };
@@ -101,7 +125,7 @@ static void rndis_query_cmplt(int status, const void *data, int size)
   c->InformationBufferLength = size;
   c->InformationBufferOffset = 16;
   c->Status = status;
-  memcpy(c + 1, data, size);
+  if (size) memcpy(c + 1, data, size);
   rndis_report();
 }
 
@@ -112,8 +136,44 @@ static void rndis_query_cmplt(int status, const void *data, int size)
 
 static const char *rndis_vendor = RNDIS_VENDOR;
 
+/* statistics OIDs are seen from the NIC: it transmits what the host sends (our recv counters)
+   and receives what goes to the host (our xmit counters) */
+static bool rndis_query_stats(rndis_Oid_t oid)
+{
+  tud_ecm_rndis_stats_t s;
+  tud_network_ecm_rndis_stats(&s);
+  const tud_network_dir_stats_t *xmit = &s.recv, *rcv = &s.xmit;
+  uint32_t v;
+
+  switch (oid)
+  {
+    case OID_GEN_XMIT_OK:                v = xmit->frames; break;
+    case OID_GEN_RCV_OK:                 v = rcv->frames; break;
+    case OID_GEN_XMIT_ERROR:             v = xmit->errors + xmit->drop_no_buffer; break;
+    case OID_GEN_RCV_ERROR:              v = rcv->errors; break;
+    case OID_GEN_RCV_NO_BUFFER:          v = rcv->drop_no_buffer; break;
+    case OID_GEN_DIRECTED_BYTES_XMIT:    v = xmit->bytes - xmit->multicast_bytes - xmit->broadcast_bytes; break;
+    case OID_GEN_DIRECTED_FRAMES_XMIT:   v = xmit->frames - xmit->multicast_frames - xmit->broadcast_frames; break;
+    case OID_GEN_MULTICAST_BYTES_XMIT:   v = xmit->multicast_bytes; break;
+    case OID_GEN_MULTICAST_FRAMES_XMIT:  v = xmit->multicast_frames; break;
+    case OID_GEN_BROADCAST_BYTES_XMIT:   v = xmit->broadcast_bytes; break;
+    case OID_GEN_BROADCAST_FRAMES_XMIT:  v = xmit->broadcast_frames; break;
+    case OID_GEN_DIRECTED_BYTES_RCV:     v = rcv->bytes - rcv->multicast_bytes - rcv->broadcast_bytes; break;
+    case OID_GEN_DIRECTED_FRAMES_RCV:    v = rcv->frames - rcv->multicast_frames - rcv->broadcast_frames; break;
+    case OID_GEN_MULTICAST_BYTES_RCV:    v = rcv->multicast_bytes; break;
+    case OID_GEN_MULTICAST_FRAMES_RCV:   v = rcv->multicast_frames; break;
+    case OID_GEN_BROADCAST_BYTES_RCV:    v = rcv->broadcast_bytes; break;
+    case OID_GEN_BROADCAST_FRAMES_RCV:   v = rcv->broadcast_frames; break;
+    default:                             return false;
+  }
+  rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, v);
+  return true;
+}
+
 static void rndis_query(void)
 {
+  if (rndis_query_stats(((rndis_query_msg_t *)encapsulated_buffer)->Oid)) return;
+
   switch (((rndis_query_msg_t *)encapsulated_buffer)->Oid)
   {
     case OID_GEN_SUPPORTED_LIST:         rndis_query_cmplt(RNDIS_STATUS_SUCCESS, OIDSupportedList, 4 * OID_LIST_LENGTH); return;
@@ -134,18 +194,17 @@ static void rndis_query(void)
     case OID_GEN_RECEIVE_BLOCK_SIZE:     rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, CFG_TUD_NET_MTU); return;
     case OID_GEN_MEDIA_CONNECT_STATUS:   rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, NDIS_MEDIA_STATE_CONNECTED); return;
     case OID_GEN_RNDIS_CONFIG_PARAMETER: rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, 0); return;
-    case OID_802_3_MAXIMUM_LIST_SIZE:    rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, 1); return;
-    case OID_802_3_MULTICAST_LIST:       rndis_query_cmplt32(RNDIS_STATUS_NOT_SUPPORTED, 0); return;
+    case OID_802_3_MAXIMUM_LIST_SIZE:    rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, CFG_TUD_NET_MC_FILTER_N ? CFG_TUD_NET_MC_FILTER_N : 1); return;
+#if CFG_TUD_NET_MC_FILTER_N
+    case OID_802_3_MULTICAST_LIST:       rndis_query_cmplt(RNDIS_STATUS_SUCCESS, oid_mc_list, 6 * oid_mc_count); return;
+#else
+    case OID_802_3_MULTICAST_LIST:       rndis_query_cmplt(RNDIS_STATUS_SUCCESS, NULL, 0); return;
+#endif
     case OID_802_3_MAC_OPTIONS:          rndis_query_cmplt32(RNDIS_STATUS_NOT_SUPPORTED, 0); return;
     case OID_GEN_MAC_OPTIONS:            rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, /*MAC_OPT*/ 0); return;
     case OID_802_3_RCV_ERROR_ALIGNMENT:  rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, 0); return;
     case OID_802_3_XMIT_ONE_COLLISION:   rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, 0); return;
     case OID_802_3_XMIT_MORE_COLLISIONS: rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, 0); return;
-    case OID_GEN_XMIT_OK:                rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, usb_eth_stat.txok); return;
-    case OID_GEN_RCV_OK:                 rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, usb_eth_stat.rxok); return;
-    case OID_GEN_RCV_ERROR:              rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, usb_eth_stat.rxbad); return;
-    case OID_GEN_XMIT_ERROR:             rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, usb_eth_stat.txbad); return;
-    case OID_GEN_RCV_NO_BUFFER:          rndis_query_cmplt32(RNDIS_STATUS_SUCCESS, 0); return;
     default:                             rndis_query_cmplt(RNDIS_STATUS_FAILURE, NULL, 0); return;
   }
 }
@@ -163,7 +222,27 @@ static void rndis_handle_config_parm(const char *data, int keyoffset, int valoff
 
 static void rndis_packetFilter(uint32_t newfilter)
 {
-    (void)newfilter;
+    netd_packet_filter(newfilter);
+}
+
+/* a reset or halt drops the packet filter, everything passes until the host sets a new one */
+static void rndis_filter_reset(void)
+{
+    oid_packet_filter = 0;
+#if CFG_TUD_NET_MC_FILTER_N
+    oid_mc_count = 0;
+#endif
+    netd_packet_filter_reset();
+}
+
+/* true if the information buffer of a SET message lies within the message received */
+static bool rndis_set_infobuf_valid(const rndis_set_msg_t *m, uint32_t msg_len)
+{
+  /* InformationBufferOffset counts from RequestId */
+  uint32_t const room = msg_len - offsetof(rndis_set_msg_t, RequestId);
+  return msg_len >= sizeof(rndis_set_msg_t) &&
+         m->InformationBufferOffset <= room &&
+         m->InformationBufferLength <= room - m->InformationBufferOffset;
 }
 
 static void rndis_handle_set_msg(void)
@@ -171,11 +250,14 @@ static void rndis_handle_set_msg(void)
   rndis_set_cmplt_t *c;
   rndis_set_msg_t *m;
   rndis_Oid_t oid;
+  uint32_t msg_len;
 
   c = (rndis_set_cmplt_t *)encapsulated_buffer;
   m = (rndis_set_msg_t *)encapsulated_buffer;
 
+  /* read before the completion header overwrites them */
   oid = m->Oid;
+  msg_len = tu_min32(m->MessageLength, encapsulated_length);
   c->MessageType = REMOTE_NDIS_SET_CMPLT;
   c->MessageLength = sizeof(rndis_set_cmplt_t);
   c->Status = RNDIS_STATUS_SUCCESS;
@@ -197,9 +279,9 @@ static void rndis_handle_set_msg(void)
     /* Mandatory general OIDs */
     case OID_GEN_CURRENT_PACKET_FILTER:
       memcpy(&oid_packet_filter, INFBUF, 4);
+      rndis_packetFilter(oid_packet_filter);
       if (oid_packet_filter)
       {
-        rndis_packetFilter(oid_packet_filter);
         rndis_state = rndis_data_initialized;
       }
       else
@@ -216,6 +298,24 @@ static void rndis_handle_set_msg(void)
 
     /* Mandatory 802_3 OIDs */
     case OID_802_3_MULTICAST_LIST:
+      if (!rndis_set_infobuf_valid(m, msg_len) || m->InformationBufferLength % 6)
+      {
+        c->Status = RNDIS_STATUS_INVALID_DATA;
+        break;
+      }
+      /* without multicast filters the list is accepted and all multicast passes */
+#if CFG_TUD_NET_MC_FILTER_N
+      if (!netd_multicast_list(INFBUF, (uint16_t)(m->InformationBufferLength / 6)))
+      {
+        c->Status = RNDIS_STATUS_MULTICAST_FULL;
+      }
+      else
+      {
+        /* kept for OID_802_3_MULTICAST_LIST queries, the driver only holds the hash */
+        oid_mc_count = (uint16_t)(m->InformationBufferLength / 6);
+        memcpy(oid_mc_list, INFBUF, 6 * oid_mc_count);
+      }
+#endif
       break;
 
     /* Power Management: fails for now */
@@ -235,13 +335,16 @@ static void rndis_handle_set_msg(void)
 void rndis_class_set_handler(uint8_t *data, int size)
 {
   encapsulated_buffer = data;
-  (void)size;
+  /* the data stage fills at most RNDIS_CONTROL_SIZE bytes of a longer request */
+  encapsulated_length = size > 0 ? tu_min32((uint32_t)size, RNDIS_CONTROL_SIZE) : 0;
 
   switch (((rndis_generic_msg_t *)encapsulated_buffer)->MessageType)
   {
     case REMOTE_NDIS_INITIALIZE_MSG:
       {
         rndis_initialize_cmplt_t *m;
+        /* read before the completion overwrites the request */
+        uint32_t host_max_transfer = ((rndis_initialize_msg_t *)encapsulated_buffer)->MaxTransferSize;
         m = ((rndis_initialize_cmplt_t *)encapsulated_buffer);
         /* m->MessageID is same as before */
         m->MessageType = REMOTE_NDIS_INITIALIZE_CMPLT;
@@ -251,9 +354,9 @@ void rndis_class_set_handler(uint8_t *data, int size)
         m->Status = RNDIS_STATUS_SUCCESS;
         m->DeviceFlags = RNDIS_DF_CONNECTIONLESS;
         m->Medium = RNDIS_MEDIUM_802_3;
-        m->MaxPacketsPerTransfer = 1;
-        m->MaxTransferSize = CFG_TUD_NET_MTU + sizeof(rndis_data_packet_t);
-        m->PacketAlignmentFactor = 0;
+        m->MaxPacketsPerTransfer = CFG_TUD_RNDIS_MAX_PACKETS_PER_XFER;
+        m->MaxTransferSize = netd_rndis_initialize(host_max_transfer);
+        m->PacketAlignmentFactor = (CFG_TUD_RNDIS_MAX_PACKETS_PER_XFER > 1) ? RNDIS_PACKET_ALIGNMENT_FACTOR : 0;
         m->AfListOffset = 0;
         m->AfListSize = 0;
         rndis_state = rndis_initialized;
@@ -274,6 +377,7 @@ void rndis_class_set_handler(uint8_t *data, int size)
         rndis_reset_cmplt_t * m;
         m = ((rndis_reset_cmplt_t *)encapsulated_buffer);
         rndis_state = rndis_uninitialized;
+        rndis_filter_reset();
         m->MessageType = REMOTE_NDIS_RESET_CMPLT;
         m->MessageLength = sizeof(rndis_reset_cmplt_t);
         m->Status = RNDIS_STATUS_SUCCESS;
@@ -283,6 +387,12 @@ void rndis_class_set_handler(uint8_t *data, int size)
       }
       break;
 
+    case REMOTE_NDIS_HALT_MSG:
+      /* no completion message */
+      rndis_state = rndis_uninitialized;
+      rndis_filter_reset();
+      break;
+
     case REMOTE_NDIS_KEEPALIVE_MSG:
       {
         rndis_keepalive_cmplt_t * m;
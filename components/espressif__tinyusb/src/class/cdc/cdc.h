@@ -181,6 +181,15 @@ typedef enum {
   CDC_REQUEST_MDLM_SEMANTIC_MODEL                          = 0x60,
 } cdc_management_request_t;
 
+/// ECM 6.2.4 SetEthernetPacketFilter, wValue bitmap
+typedef enum {
+  CDC_ETHERNET_PACKET_TYPE_PROMISCUOUS   = 0x01,
+  CDC_ETHERNET_PACKET_TYPE_ALL_MULTICAST = 0x02,
+  CDC_ETHERNET_PACKET_TYPE_DIRECTED      = 0x04,
+  CDC_ETHERNET_PACKET_TYPE_BROADCAST     = 0x08,
+  CDC_ETHERNET_PACKET_TYPE_MULTICAST     = 0x10, ///< multicast addresses of the SetEthernetMulticastFilters list
+} cdc_ethernet_packet_filter_t;
+
 typedef enum {
   CDC_CONTROL_LINE_STATE_DTR = 0x01,
   CDC_CONTROL_LINE_STATE_RTS = 0x02,
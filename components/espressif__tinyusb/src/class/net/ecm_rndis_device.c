@@ -0,0 +1,683 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Peter Lawrence
+ * Copyright (c) 2019 Ha Thach (tinyusb.org)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * This file is part of the TinyUSB stack.
+ */
+
+#include "tusb_option.h"
+
+#if ( CFG_TUD_ENABLED && CFG_TUD_ECM_RNDIS )
+
+#include "device/usbd.h"
+#include "device/usbd_pvt.h"
+
+#include "net_device.h"
+#include "rndis_protocol.h"
+
+extern void rndis_class_set_handler(uint8_t *data, int size); /* found in ./misc/networking/rndis_reports.c */
+
+#define CFG_TUD_NET_PACKET_PREFIX_LEN sizeof(rndis_data_packet_t)
+#define CFG_TUD_NET_PACKET_SUFFIX_LEN 0
+
+// one REMOTE_NDIS_PACKET_MSG of a multi-packet transfer, padded to the next message
+#define NETD_RNDIS_MSG_SIZE (TU_DIV_CEIL(CFG_TUD_NET_PACKET_PREFIX_LEN + CFG_TUD_NET_MTU, RNDIS_PACKET_ALIGNMENT) * RNDIS_PACKET_ALIGNMENT)
+
+#define NETD_PACKET_SIZE  TU_MAX(CFG_TUD_NET_PACKET_PREFIX_LEN + CFG_TUD_NET_MTU + CFG_TUD_NET_PACKET_PREFIX_LEN, \
+                                 CFG_TUD_RNDIS_MAX_PACKETS_PER_XFER * NETD_RNDIS_MSG_SIZE)
+#define NETD_CONTROL_SIZE RNDIS_CONTROL_SIZE
+
+TU_VERIFY_STATIC(6 * CFG_TUD_NET_MC_FILTER_N <= NETD_CONTROL_SIZE - sizeof(rndis_set_msg_t), "CFG_TUD_NET_MC_FILTER_N too large");
+
+TU_VERIFY_STATIC(CFG_TUD_ECM_RNDIS_OUT_BUF_N >= 1 && CFG_TUD_ECM_RNDIS_OUT_BUF_N <= 255, "CFG_TUD_ECM_RNDIS_OUT_BUF_N out of range");
+TU_VERIFY_STATIC(CFG_TUD_ECM_RNDIS_IN_BUF_N >= 1 && CFG_TUD_ECM_RNDIS_IN_BUF_N <= 255, "CFG_TUD_ECM_RNDIS_IN_BUF_N out of range");
+TU_VERIFY_STATIC(CFG_TUD_RNDIS_MAX_PACKETS_PER_XFER >= 1 && NETD_PACKET_SIZE <= UINT16_MAX, "CFG_TUD_RNDIS_MAX_PACKETS_PER_XFER out of range");
+
+//--------------------------------------------------------------------+
+// MACRO CONSTANT TYPEDEF
+//--------------------------------------------------------------------+
+typedef struct {
+  uint8_t itf_num;      // Index number of Management Interface, +1 for Data Interface
+  uint8_t itf_data_alt; // Alternate setting of Data Interface. 0 : inactive, 1 : active
+
+  uint8_t ep_notif;
+  uint8_t ep_in;
+  uint8_t ep_out;
+
+  bool ecm_mode;
+  bool data_open;       // data endpoints are open, frames can be transmitted
+  bool ecm_reporting;   // host has set a packet filter, link changes are reported from then on
+  bool ecm_report_pending; // link changed while the notification endpoint was busy
+
+  // Copy of the data endpoint descriptors, opened when receiving SetInterface.  The configuration
+  // descriptor they come from may not be long-lived memory
+  tusb_desc_endpoint_t ecm_desc_ep[2];
+
+  // OUT buffers form a ring: rx_count filled buffers starting at rx_rd, the OUT transfer (rx_busy)
+  // fills the buffer after them.  The frames of the first one are handed to the application one at
+  // a time from rx_ofs on (RNDIS may pack several into a transfer), the current one is held until
+  // its renew while rx_held
+  uint8_t rx_rd;
+  uint8_t rx_count;
+  bool rx_busy;
+  bool rx_held;
+  bool rx_delivering;   // netd_rx_deliver() is active, tud_network_recv_renew() must not re-enter it
+  uint16_t rx_ofs;
+  uint16_t rx_len[CFG_TUD_ECM_RNDIS_OUT_BUF_N];
+
+  // IN buffers likewise: tx_count transfers starting at tx_rd, the first one is on the wire while
+  // tx_busy.  RNDIS appends frames to the last one as long as it is waiting (multi-packet transfer).
+  uint8_t tx_rd;
+  uint8_t tx_count;
+  bool tx_busy;
+  bool tx_append;       // tud_network_can_xmit() found room in the last transfer for the next frame
+  uint16_t tx_len[CFG_TUD_ECM_RNDIS_IN_BUF_N];
+  uint16_t tx_last[CFG_TUD_ECM_RNDIS_IN_BUF_N];  // offset of the last message in the transfer
+  uint8_t tx_pkts[CFG_TUD_ECM_RNDIS_IN_BUF_N];   // messages in the transfer
+
+  uint32_t rndis_xmit_max; // largest IN transfer the host accepts, 0: one message per transfer
+
+  netd_filter_t filter; // packet filter and multicast filters selected by the host
+} netd_interface_t;
+
+typedef struct ecm_notify_struct {
+  tusb_control_request_t header;
+  uint32_t downlink, uplink;
+} ecm_notify_t;
+
+typedef struct {
+  struct {
+    TUD_EPBUF_DEF(pkt, NETD_PACKET_SIZE);
+  } rx[CFG_TUD_ECM_RNDIS_OUT_BUF_N];
+  struct {
+    TUD_EPBUF_DEF(pkt, NETD_PACKET_SIZE);
+  } tx[CFG_TUD_ECM_RNDIS_IN_BUF_N];
+
+  TUD_EPBUF_DEF(notify, sizeof(ecm_notify_t));
+  TUD_EPBUF_DEF(ctrl, NETD_CONTROL_SIZE);
+} netd_epbuf_t;
+
+//--------------------------------------------------------------------+
+// INTERNAL OBJECT & FUNCTION DECLARATION
+//--------------------------------------------------------------------+
+static netd_interface_t _netd_itf;
+CFG_TUD_MEM_SECTION static netd_epbuf_t _netd_epbuf;
+
+/* traffic counters, kept over bus resets */
+static tud_ecm_rndis_stats_t _netd_stats;
+
+/* upstream link reported by the ECM notifications, see tud_network_link_state();
+   kept over bus resets, speeds of 0 report the default */
+static struct {
+  bool connected;
+  uint32_t downlink, uplink;
+} _netd_link = { .connected = true };
+
+// optional application callback, see net_device.h
+TU_ATTR_WEAK void tud_network_xmit_done_cb(void) {
+}
+
+/* NDIS packet type of a frame by its destination address */
+static uint32_t netd_frame_type(uint8_t const *frame, uint16_t size) {
+  if (size < 6 || !(frame[0] & 0x01)) {
+    return NDIS_PACKET_TYPE_DIRECTED;
+  }
+  if ((frame[0] & frame[1] & frame[2] & frame[3] & frame[4] & frame[5]) == 0xff) {
+    return NDIS_PACKET_TYPE_BROADCAST;
+  }
+  return NDIS_PACKET_TYPE_MULTICAST;
+}
+
+static void netd_count_frame(tud_network_dir_stats_t *st, uint32_t type, uint16_t size) {
+  st->frames++;
+  st->bytes += size;
+  if (type == NDIS_PACKET_TYPE_BROADCAST) {
+    st->broadcast_frames++;
+    st->broadcast_bytes += size;
+  } else if (type == NDIS_PACKET_TYPE_MULTICAST) {
+    st->multicast_frames++;
+    st->multicast_bytes += size;
+  }
+}
+
+/* RNDIS packet filter (NDIS_PACKET_TYPE_* bits), kept as the CDC-ECM 6.2.4 bitmap */
+void netd_packet_filter(uint32_t ndis_filter) {
+  _netd_itf.filter.packet = (uint16_t)(((ndis_filter & NDIS_PACKET_TYPE_PROMISCUOUS) ? CDC_ETHERNET_PACKET_TYPE_PROMISCUOUS : 0) |
+                                       ((ndis_filter & NDIS_PACKET_TYPE_ALL_MULTICAST) ? CDC_ETHERNET_PACKET_TYPE_ALL_MULTICAST : 0) |
+                                       ((ndis_filter & NDIS_PACKET_TYPE_DIRECTED) ? CDC_ETHERNET_PACKET_TYPE_DIRECTED : 0) |
+                                       ((ndis_filter & NDIS_PACKET_TYPE_BROADCAST) ? CDC_ETHERNET_PACKET_TYPE_BROADCAST : 0) |
+                                       ((ndis_filter & NDIS_PACKET_TYPE_MULTICAST) ? CDC_ETHERNET_PACKET_TYPE_MULTICAST : 0));
+  _netd_itf.filter.set = true;
+}
+
+void netd_packet_filter_reset(void) {
+  tu_memclr(&_netd_itf.filter, sizeof(_netd_itf.filter));
+}
+
+bool netd_multicast_list(uint8_t const *addrs, uint16_t count) {
+  TU_VERIFY(count <= CFG_TUD_NET_MC_FILTER_N);
+  netd_filter_mc_set(&_netd_itf.filter, addrs, count);
+  return true;
+}
+
+bool tud_network_filter_accepts(const uint8_t *dst) {
+  return netd_filter_accepts(&_netd_itf.filter, dst);
+}
+
+void tud_network_ecm_rndis_stats(tud_ecm_rndis_stats_t *stats) {
+  *stats = _netd_stats;
+}
+
+/* queue the next OUT transfer if a buffer is free, the previous frames may still be in use */
+static void netd_rx_arm(void) {
+  if (_netd_itf.ep_out == 0 || _netd_itf.rx_busy || _netd_itf.rx_count >= CFG_TUD_ECM_RNDIS_OUT_BUF_N) {
+    return;
+  }
+  uint8_t const idx = (uint8_t)((_netd_itf.rx_rd + _netd_itf.rx_count) % CFG_TUD_ECM_RNDIS_OUT_BUF_N);
+  _netd_itf.rx_busy = usbd_edpt_xfer(0, _netd_itf.ep_out, _netd_epbuf.rx[idx].pkt, NETD_PACKET_SIZE);
+}
+
+/* next frame of the oldest OUT buffer from rx_ofs on: ECM has one frame per transfer, RNDIS one or
+   more concatenated REMOTE_NDIS_PACKET_MSGs.  Returns false at the end of the transfer, a malformed
+   message ends it as well */
+static bool netd_rx_next_frame(uint8_t **frame, uint16_t *size) {
+  uint8_t *const buf = _netd_epbuf.rx[_netd_itf.rx_rd].pkt;
+  uint32_t const len = _netd_itf.rx_len[_netd_itf.rx_rd];
+  uint32_t const ofs = _netd_itf.rx_ofs;
+
+  if (_netd_itf.ecm_mode) {
+    if (ofs || !len) {
+      return false;
+    }
+    *frame = buf;
+    *size = (uint16_t)len;
+    _netd_itf.rx_ofs = (uint16_t)len;
+    return true;
+  }
+
+  if (ofs + sizeof(rndis_data_packet_t) > len) {
+    return false;
+  }
+  rndis_data_packet_t const *r = (rndis_data_packet_t const *)((void const *)(buf + ofs));
+  uint32_t const msg_len = tu_le32toh(r->MessageLength);
+  uint32_t const data_ofs = tu_le32toh(r->DataOffset);
+  uint32_t const data_len = tu_le32toh(r->DataLength);
+  // DataOffset counts from its own field; checked once msg_len is known to cover the header
+  uint32_t const data_room = msg_len - offsetof(rndis_data_packet_t, DataOffset);
+  if (tu_le32toh(r->MessageType) != REMOTE_NDIS_PACKET_MSG ||
+      msg_len < sizeof(rndis_data_packet_t) || msg_len > len - ofs ||
+      data_ofs > data_room || data_len > data_room - data_ofs || data_len > UINT16_MAX) {
+    _netd_stats.recv.errors++;
+    return false;
+  }
+  *frame = buf + ofs + offsetof(rndis_data_packet_t, DataOffset) + data_ofs;
+  *size = (uint16_t)data_len;
+  _netd_itf.rx_ofs = (uint16_t)(ofs + msg_len);
+  return true;
+}
+
+/* hand the received frames to the application, one at a time: the next one follows the renew of the
+   previous one.  Buffers are re-armed as soon as all their frames are through */
+static void netd_rx_deliver(void) {
+  if (_netd_itf.rx_delivering) {
+    return;
+  }
+  _netd_itf.rx_delivering = true;
+  while (!_netd_itf.rx_held && _netd_itf.rx_count) {
+    uint8_t *frame;
+    uint16_t size;
+    if (!netd_rx_next_frame(&frame, &size)) {
+      _netd_itf.rx_rd = (uint8_t)((_netd_itf.rx_rd + 1) % CFG_TUD_ECM_RNDIS_OUT_BUF_N);
+      _netd_itf.rx_count--;
+      _netd_itf.rx_ofs = 0;
+      netd_rx_arm();
+      continue;
+    }
+    _netd_itf.rx_held = true;
+    if (tud_network_recv_cb(frame, size)) {
+      netd_count_frame(&_netd_stats.recv, netd_frame_type(frame, size), size);
+    } else {
+      /* if a buffer was never handled by user code, we must renew on the user's behalf */
+      _netd_itf.rx_held = false;
+      _netd_stats.recv.drop_no_buffer++;
+    }
+  }
+  _netd_itf.rx_delivering = false;
+}
+
+void tud_network_recv_renew(void) {
+  _netd_itf.rx_held = false;
+  netd_rx_arm();
+  netd_rx_deliver();
+}
+
+/* start the IN transfer of the oldest queued frame */
+static void netd_tx_start(void) {
+  if (_netd_itf.tx_busy || _netd_itf.tx_count == 0) {
+    return;
+  }
+  _netd_itf.tx_busy = true;
+  usbd_edpt_xfer(0, _netd_itf.ep_in, _netd_epbuf.tx[_netd_itf.tx_rd].pkt, _netd_itf.tx_len[_netd_itf.tx_rd]);
+}
+
+void netd_report(uint8_t *buf, uint16_t len) {
+  const uint8_t rhport = 0;
+  len = tu_min16(len, sizeof(ecm_notify_t));
+
+  TU_VERIFY(usbd_edpt_claim(rhport, _netd_itf.ep_notif), );
+  memcpy(_netd_epbuf.notify, buf, len);
+  usbd_edpt_xfer(rhport, _netd_itf.ep_notif, _netd_epbuf.notify, len);
+}
+
+//--------------------------------------------------------------------+
+// USBD Driver API
+//--------------------------------------------------------------------+
+void netd_init(void) {
+  tu_memclr(&_netd_itf, sizeof(_netd_itf));
+}
+
+bool netd_deinit(void) {
+  return true;
+}
+
+void netd_reset(uint8_t rhport) {
+  (void) rhport;
+  netd_init();
+}
+
+uint16_t netd_open(uint8_t rhport, tusb_desc_interface_t const * itf_desc, uint16_t max_len) {
+  bool const is_rndis = (TUD_RNDIS_ITF_CLASS    == itf_desc->bInterfaceClass    &&
+                         TUD_RNDIS_ITF_SUBCLASS == itf_desc->bInterfaceSubClass &&
+                         TUD_RNDIS_ITF_PROTOCOL == itf_desc->bInterfaceProtocol);
+
+  bool const is_ecm = (TUSB_CLASS_CDC                           == itf_desc->bInterfaceClass &&
+                       CDC_COMM_SUBCLASS_ETHERNET_CONTROL_MODEL == itf_desc->bInterfaceSubClass &&
+                       0x00                                     == itf_desc->bInterfaceProtocol);
+
+  TU_VERIFY(is_rndis || is_ecm, 0);
+
+  // confirm interface hasn't already been allocated
+  TU_ASSERT(0 == _netd_itf.ep_notif, 0);
+
+  // sanity check the descriptor
+  _netd_itf.ecm_mode = is_ecm;
+
+  //------------- Management Interface -------------//
+  _netd_itf.itf_num = itf_desc->bInterfaceNumber;
+
+  uint16_t drv_len = sizeof(tusb_desc_interface_t);
+  uint8_t const * p_desc = tu_desc_next( itf_desc );
+
+  // Communication Functional Descriptors
+  while (TUSB_DESC_CS_INTERFACE == tu_desc_type(p_desc) && drv_len <= max_len) {
+    drv_len += tu_desc_len(p_desc);
+    p_desc   = tu_desc_next(p_desc);
+  }
+
+  // notification endpoint (if any)
+  if (TUSB_DESC_ENDPOINT == tu_desc_type(p_desc)) {
+    TU_ASSERT(usbd_edpt_open(rhport, (tusb_desc_endpoint_t const *) p_desc), 0);
+
+    _netd_itf.ep_notif = ((tusb_desc_endpoint_t const*)p_desc)->bEndpointAddress;
+
+    drv_len += tu_desc_len(p_desc);
+    p_desc = tu_desc_next(p_desc);
+  }
+
+  //------------- Data Interface -------------//
+  // - RNDIS Data followed immediately by a pair of endpoints
+  // - CDC-ECM data interface has 2 alternate settings
+  //   - 0 : zero endpoints for inactive (default)
+  //   - 1 : IN & OUT endpoints for active networking
+  TU_ASSERT(TUSB_DESC_INTERFACE == tu_desc_type(p_desc), 0);
+
+  do {
+    tusb_desc_interface_t const * data_itf_desc = (tusb_desc_interface_t const *) p_desc;
+    TU_ASSERT(TUSB_CLASS_CDC_DATA == data_itf_desc->bInterfaceClass, 0);
+
+    drv_len += tu_desc_len(p_desc);
+    p_desc   = tu_desc_next(p_desc);
+  } while (_netd_itf.ecm_mode && (TUSB_DESC_INTERFACE == tu_desc_type(p_desc)) && (drv_len <= max_len));
+
+  // Pair of endpoints
+  TU_ASSERT(TUSB_DESC_ENDPOINT == tu_desc_type(p_desc), 0);
+
+  if (_netd_itf.ecm_mode) {
+    // ECM by default is in-active, save the endpoint attributes
+    // to open later when received setInterface
+    uint8_t const * p_ep2 = tu_desc_next(p_desc);
+    TU_ASSERT(drv_len + 2*sizeof(tusb_desc_endpoint_t) <= max_len, 0);
+    TU_ASSERT(sizeof(tusb_desc_endpoint_t) == tu_desc_len(p_desc) && TUSB_DESC_ENDPOINT == tu_desc_type(p_ep2) &&
+              sizeof(tusb_desc_endpoint_t) == tu_desc_len(p_ep2), 0);
+    memcpy(&_netd_itf.ecm_desc_ep[0], p_desc, sizeof(tusb_desc_endpoint_t));
+    memcpy(&_netd_itf.ecm_desc_ep[1], p_ep2, sizeof(tusb_desc_endpoint_t));
+  } else {
+    // Open endpoint pair for RNDIS
+    TU_ASSERT(usbd_open_edpt_pair(rhport, p_desc, 2, TUSB_XFER_BULK, &_netd_itf.ep_out, &_netd_itf.ep_in), 0);
+
+    tud_network_init_cb();
+
+    // we are ready to transmit a packet
+    _netd_itf.data_open = true;
+
+    // prepare for incoming packets
+    tud_network_recv_renew();
+  }
+
+  drv_len += 2*sizeof(tusb_desc_endpoint_t);
+
+  return drv_len;
+}
+
+static void ecm_report(bool nc) {
+  const ecm_notify_t ecm_notify_nc = {
+    .header = {
+      .bmRequestType = 0xA1,
+      .bRequest = 0, /* NETWORK_CONNECTION aka NetworkConnection */
+      .wValue = 1,   /* Connected, updated below */
+      .wLength = 0,
+    },
+  };
+
+  const ecm_notify_t ecm_notify_csc = {
+    .header = {
+      .bmRequestType = 0xA1,
+      .bRequest = 0x2A, /* CONNECTION_SPEED_CHANGE aka ConnectionSpeedChange */
+      .wLength = 8,
+    },
+    .downlink = 9728000,
+    .uplink = 9728000,
+  };
+
+  ecm_notify_t notify = (nc) ? ecm_notify_nc : ecm_notify_csc;
+  notify.header.wIndex = _netd_itf.itf_num;
+  if (nc) {
+    notify.header.wValue = _netd_link.connected ? 1 : 0;
+  } else {
+    if (_netd_link.downlink) notify.downlink = _netd_link.downlink;
+    if (_netd_link.uplink) notify.uplink = _netd_link.uplink;
+  }
+  netd_report((uint8_t *)&notify, (nc) ? sizeof(notify.header) : sizeof(notify));
+}
+
+void tud_network_link_state(bool connected, uint32_t downlink, uint32_t uplink) {
+  if (_netd_link.connected == connected && _netd_link.downlink == downlink && _netd_link.uplink == uplink) {
+    return;
+  }
+  _netd_link.connected = connected;
+  _netd_link.downlink = downlink;
+  _netd_link.uplink = uplink;
+
+  /* RNDIS answers link queries from rndis_reports.c, only ECM notifies */
+  if (!_netd_itf.ecm_mode || !_netd_itf.ecm_reporting) {
+    return;
+  }
+  if (usbd_edpt_busy(0, _netd_itf.ep_notif)) {
+    /* sent again once the current NetworkConnection/ConnectionSpeedChange pair is through */
+    _netd_itf.ecm_report_pending = true;
+  } else {
+    ecm_report(true);
+  }
+}
+
+// Invoked when a control transfer occurred on an interface of this class
+// Driver response accordingly to the request and the transfer stage (setup/data/ack)
+// return false to stall control endpoint (e.g unsupported request)
+bool netd_control_xfer_cb (uint8_t rhport, uint8_t stage, tusb_control_request_t const * request) {
+  if (stage == CONTROL_STAGE_SETUP) {
+    switch (request->bmRequestType_bit.type) {
+      case TUSB_REQ_TYPE_STANDARD:
+        switch (request->bRequest) {
+          case TUSB_REQ_GET_INTERFACE: {
+            uint8_t const req_itfnum = (uint8_t)request->wIndex;
+            TU_VERIFY(_netd_itf.itf_num+1 == req_itfnum);
+
+            tud_control_xfer(rhport, request, &_netd_itf.itf_data_alt, 1);
+          }
+          break;
+
+          case TUSB_REQ_SET_INTERFACE: {
+            uint8_t const req_itfnum = (uint8_t)request->wIndex;
+            uint8_t const req_alt = (uint8_t)request->wValue;
+
+            // Only valid for Data Interface with Alternate is either 0 or 1
+            TU_VERIFY(_netd_itf.itf_num+1 == req_itfnum && req_alt < 2);
+
+            // ACM-ECM only: qequest to enable/disable network activities
+            TU_VERIFY(_netd_itf.ecm_mode);
+
+            _netd_itf.itf_data_alt = req_alt;
+
+            if (_netd_itf.itf_data_alt) {
+              // The endpoints are opened from the cached descriptors once and stay open: closing is a
+              // no-op on controllers with the ISO alloc API (dwc2), and opening again would allocate
+              // their FIFOs a second time
+              if (_netd_itf.ep_in == 0 && _netd_itf.ep_out == 0) {
+                TU_ASSERT(_netd_itf.ecm_desc_ep[0].bLength);
+                TU_ASSERT(
+                  usbd_open_edpt_pair(rhport, (uint8_t const *) _netd_itf.ecm_desc_ep, 2, TUSB_XFER_BULK, &_netd_itf.ep_out, &
+                    _netd_itf.ep_in));
+
+                // same bring-up as RNDIS in netd_open(), on the first selection of alternate 1 only:
+                // alternate 0 keeps the endpoints open and the application's network running
+                tud_network_init_cb();
+                _netd_itf.data_open = true; // we are ready to transmit a packet
+                tud_network_recv_renew(); // prepare for incoming packets
+              }
+            } else {
+              // Endpoints stay open (see above), this should have no harm since host won't try to
+              // communicate with the endpoints again until it selects alternate 1
+            }
+
+            tud_control_status(rhport, request);
+          }
+          break;
+
+          // unsupported request
+          default: return false;
+        }
+        break;
+
+      case TUSB_REQ_TYPE_CLASS:
+        TU_VERIFY(_netd_itf.itf_num == request->wIndex);
+
+        if (_netd_itf.ecm_mode) {
+          /* the only required CDC-ECM Management Element Request is SetEthernetPacketFilter */
+          if (CDC_REQUEST_SET_ETHERNET_PACKET_FILTER == request->bRequest) {
+            tud_control_xfer(rhport, request, NULL, 0);
+            _netd_itf.filter.packet = request->wValue;
+            _netd_itf.filter.set = true;
+            _netd_itf.ecm_reporting = true;
+            ecm_report(true);
+          } else if (CFG_TUD_NET_MC_FILTER_N && CDC_REQUEST_SET_ETHERNET_MULTICAST_FILTERS == request->bRequest) {
+            /* wValue addresses of 6 bytes, applied in the data stage */
+            TU_VERIFY(request->wValue <= CFG_TUD_NET_MC_FILTER_N && request->wLength == 6 * request->wValue);
+            if (request->wLength == 0) {
+              netd_filter_mc_set(&_netd_itf.filter, NULL, 0);
+            }
+            tud_control_xfer(rhport, request, _netd_epbuf.ctrl, request->wLength);
+          }
+        } else {
+          if (request->bmRequestType_bit.direction == TUSB_DIR_IN) {
+            rndis_generic_msg_t* rndis_msg = (rndis_generic_msg_t*)((void*)_netd_epbuf.ctrl);
+            uint32_t msglen = tu_le32toh(rndis_msg->MessageLength);
+            TU_ASSERT(msglen <= NETD_CONTROL_SIZE);
+            tud_control_xfer(rhport, request, _netd_epbuf.ctrl, (uint16_t)msglen);
+          } else {
+            tud_control_xfer(rhport, request, _netd_epbuf.ctrl, NETD_CONTROL_SIZE);
+          }
+        }
+        break;
+
+      // unsupported request
+      default: return false;
+    }
+  } else if (stage == CONTROL_STAGE_DATA) {
+    // Handle RNDIS class control OUT only
+    if (request->bmRequestType_bit.type == TUSB_REQ_TYPE_CLASS &&
+        request->bmRequestType_bit.direction == TUSB_DIR_OUT &&
+        _netd_itf.itf_num == request->wIndex) {
+      if (!_netd_itf.ecm_mode) {
+        rndis_class_set_handler(_netd_epbuf.ctrl, request->wLength);
+      } else if (CDC_REQUEST_SET_ETHERNET_MULTICAST_FILTERS == request->bRequest) {
+        netd_filter_mc_set(&_netd_itf.filter, _netd_epbuf.ctrl, request->wValue);
+      }
+    }
+  }
+
+  return true;
+}
+
+bool netd_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes) {
+  (void)result;
+
+  /* new packet received: re-arm into the next free buffer before handing this one over */
+  if (ep_addr == _netd_itf.ep_out) {
+    uint8_t const idx = (uint8_t)((_netd_itf.rx_rd + _netd_itf.rx_count) % CFG_TUD_ECM_RNDIS_OUT_BUF_N);
+    _netd_itf.rx_len[idx] = (uint16_t)xferred_bytes;
+    _netd_itf.rx_count++;
+    _netd_itf.rx_busy = false;
+    netd_rx_arm();
+    netd_rx_deliver();
+  }
+
+  /* data transmission finished */
+  if (ep_addr == _netd_itf.ep_in) {
+    /* TinyUSB requires the class driver to implement ZLP (since ZLP usage is class-specific) */
+
+    if (xferred_bytes && (0 == (xferred_bytes % CFG_TUD_NET_ENDPOINT_SIZE))) {
+      usbd_edpt_xfer(rhport, _netd_itf.ep_in, NULL, 0); /* a ZLP is needed */
+    } else {
+      /* we're finally finished, the buffer is free and the next frame can go */
+      _netd_itf.tx_busy = false;
+      _netd_itf.tx_rd = (uint8_t)((_netd_itf.tx_rd + 1) % CFG_TUD_ECM_RNDIS_IN_BUF_N);
+      _netd_itf.tx_count--;
+      netd_tx_start();
+      tud_network_xmit_done_cb();
+    }
+  }
+
+  if (_netd_itf.ecm_mode && (ep_addr == _netd_itf.ep_notif)) {
+    if (sizeof(tusb_control_request_t) == xferred_bytes) {
+      ecm_report(false);
+    } else if (_netd_itf.ecm_report_pending) {
+      _netd_itf.ecm_report_pending = false;
+      ecm_report(true);
+    }
+  }
+
+  return true;
+}
+
+/* RNDIS: the last queued IN transfer is still waiting and can take another message of size bytes */
+static bool netd_tx_can_append(uint16_t size) {
+  if (_netd_itf.ecm_mode || _netd_itf.tx_count == 0) {
+    return false;
+  }
+  uint8_t const idx = (uint8_t)((_netd_itf.tx_rd + _netd_itf.tx_count - 1) % CFG_TUD_ECM_RNDIS_IN_BUF_N);
+  if (idx == _netd_itf.tx_rd && _netd_itf.tx_busy) {
+    return false;
+  }
+  uint32_t const ofs = tu_round_up(_netd_itf.tx_len[idx], RNDIS_PACKET_ALIGNMENT);
+  // the buffer has room for any frame, the host limit is checked with the actual size
+  return _netd_itf.tx_pkts[idx] < CFG_TUD_RNDIS_MAX_PACKETS_PER_XFER &&
+         ofs + CFG_TUD_NET_PACKET_PREFIX_LEN + CFG_TUD_NET_MTU <= NETD_PACKET_SIZE &&
+         ofs + CFG_TUD_NET_PACKET_PREFIX_LEN + size <= _netd_itf.rndis_xmit_max;
+}
+
+bool tud_network_can_xmit(uint16_t size) {
+  if (!_netd_itf.data_open) {
+    return false;
+  }
+  _netd_itf.tx_append = netd_tx_can_append(size);
+  return _netd_itf.tx_append || _netd_itf.tx_count < CFG_TUD_ECM_RNDIS_IN_BUF_N;
+}
+
+void tud_network_xmit(void *ref, uint16_t arg) {
+  // the frame size is only known to tud_network_can_xmit(), re-check everything but the host limit
+  bool const append = _netd_itf.tx_append && netd_tx_can_append(0);
+  _netd_itf.tx_append = false;
+  if (!append && !(_netd_itf.data_open && _netd_itf.tx_count < CFG_TUD_ECM_RNDIS_IN_BUF_N)) {
+    _netd_stats.xmit.drop_no_buffer++;
+    return;
+  }
+
+  uint8_t idx;
+  uint16_t ofs = 0;
+  if (append) {
+    idx = (uint8_t)((_netd_itf.tx_rd + _netd_itf.tx_count - 1) % CFG_TUD_ECM_RNDIS_IN_BUF_N);
+    ofs = (uint16_t)tu_round_up(_netd_itf.tx_len[idx], RNDIS_PACKET_ALIGNMENT);
+  } else {
+    idx = (uint8_t)((_netd_itf.tx_rd + _netd_itf.tx_count) % CFG_TUD_ECM_RNDIS_IN_BUF_N);
+  }
+
+  uint8_t* const buf = _netd_epbuf.tx[idx].pkt + ofs;
+  uint16_t len = (_netd_itf.ecm_mode) ? 0 : CFG_TUD_NET_PACKET_PREFIX_LEN;
+  uint8_t* data = buf + len;
+
+  uint16_t const size = tud_network_xmit_cb(data, ref, arg);
+  len += size;
+
+  // the frame only counts as queued once the packet filter passed it, else the buffer is reused as is
+  uint32_t const type = netd_frame_type(data, size);
+  if (size >= 6 && !netd_filter_accepts(&_netd_itf.filter, data)) {
+    _netd_stats.xmit.drop_filter++;
+    return;
+  }
+  netd_count_frame(&_netd_stats.xmit, type, size);
+
+  if (append) {
+    // pad the previous message up to the alignment, its MessageLength covers the padding
+    uint8_t *const first = _netd_epbuf.tx[idx].pkt;
+    rndis_data_packet_t *prev = (rndis_data_packet_t *)((void *)(first + _netd_itf.tx_last[idx]));
+    memset(first + _netd_itf.tx_len[idx], 0, ofs - _netd_itf.tx_len[idx]);
+    prev->MessageLength += (uint32_t)(ofs - _netd_itf.tx_len[idx]);
+  }
+
+  if (!_netd_itf.ecm_mode) {
+    rndis_data_packet_t *hdr = (rndis_data_packet_t *) ((void*) buf);
+    memset(hdr, 0, sizeof(rndis_data_packet_t));
+    hdr->MessageType = REMOTE_NDIS_PACKET_MSG;
+    hdr->MessageLength = len;
+    hdr->DataOffset = sizeof(rndis_data_packet_t) - offsetof(rndis_data_packet_t, DataOffset);
+    hdr->DataLength = len - sizeof(rndis_data_packet_t);
+  }
+
+  _netd_itf.tx_last[idx] = ofs;
+  _netd_itf.tx_len[idx] = (uint16_t)(ofs + len);
+  if (append) {
+    _netd_itf.tx_pkts[idx]++;
+  } else {
+    _netd_itf.tx_pkts[idx] = 1;
+    _netd_itf.tx_count++;
+    netd_tx_start();
+  }
+}
+
+uint32_t netd_rndis_initialize(uint32_t host_max_transfer) {
+  _netd_itf.rndis_xmit_max = (CFG_TUD_RNDIS_MAX_PACKETS_PER_XFER > 1) ? tu_min32(host_max_transfer, NETD_PACKET_SIZE) : 0;
+  return (CFG_TUD_RNDIS_MAX_PACKETS_PER_XFER > 1) ? CFG_TUD_RNDIS_MAX_PACKETS_PER_XFER * NETD_RNDIS_MSG_SIZE
+                                                  : CFG_TUD_NET_PACKET_PREFIX_LEN + CFG_TUD_NET_MTU;
+}
+
+#endif
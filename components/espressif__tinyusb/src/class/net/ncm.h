@@ -78,6 +78,42 @@
   #define CFG_TUD_NCM_OUT_MAX_DATAGRAMS_PER_NTB 6
 #endif
 
+// Number of datagrams (over all NDPs) a received NTB may carry.  The datagrams are collected into a
+// table of this size while the NTB is validated, NTBs with more datagrams are dropped.  Costs 4 bytes
+// per entry and receive NTB.
+#ifndef CFG_TUD_NCM_OUT_DATAGRAM_TABLE_N
+  #define CFG_TUD_NCM_OUT_DATAGRAM_TABLE_N 32
+#endif
+
+// Number of chained NDPs (wNextNdpIndex) accepted in a received NTB
+#ifndef CFG_TUD_NCM_OUT_MAX_NDPS_PER_NTB
+  #define CFG_TUD_NCM_OUT_MAX_NDPS_PER_NTB 8
+#endif
+
+// Check the consistency of the NTB free/ready lists on every driver entry (debug aid, costs a walk over all NTBs)
+#ifndef CFG_TUD_NCM_CHECK_LISTS
+  #define CFG_TUD_NCM_CHECK_LISTS (CFG_TUSB_DEBUG >= 2)
+#endif
+
+// Transmit datagrams by reference: the IN transfer is gathered from the NTB header and the datagram
+// segments described by tud_network_xmit_sg_cb() (see usbd_edpt_xfer_sg()), the datagrams are released
+// by tud_network_xmit_sg_release_cb() when the transfer completed.  If the DCD can not gather (e.g. DWC2
+// in buffer DMA mode) the segments are copied into the NTB right before the transfer.
+#ifndef CFG_TUD_NCM_XMIT_SG
+  #define CFG_TUD_NCM_XMIT_SG 0
+#endif
+
+// Segments per datagram with CFG_TUD_NCM_XMIT_SG, datagrams made of more segments are copied into the NTB
+#ifndef CFG_TUD_NCM_XMIT_SG_SEGS_PER_DATAGRAM
+  #define CFG_TUD_NCM_XMIT_SG_SEGS_PER_DATAGRAM 3
+#endif
+
+TU_VERIFY_STATIC(1 + CFG_TUD_NCM_IN_MAX_DATAGRAMS_PER_NTB * (CFG_TUD_NCM_XMIT_SG_SEGS_PER_DATAGRAM + 1) <= 255,
+                 "xmit segment list of an NTB is limited to 255 entries");
+
+TU_VERIFY_STATIC(CFG_TUD_NCM_OUT_MAX_DATAGRAMS_PER_NTB >= 1 && CFG_TUD_NCM_OUT_MAX_DATAGRAMS_PER_NTB <= CFG_TUD_NCM_OUT_DATAGRAM_TABLE_N,
+                 "wNtbOutMaxDatagrams must fit into the datagram table");
+
 // Table 6.2 Class-Specific Request Codes for Network Control Model subclass
 typedef enum
 {
@@ -103,6 +139,24 @@ typedef enum
 #define NDP16_SIGNATURE_NCM0 0x304D434E
 #define NDP16_SIGNATURE_NCM1 0x314D434E
 
+#define NTH32_SIGNATURE 0x686D636E
+#define NDP32_SIGNATURE_NCM0 0x306D636E
+#define NDP32_SIGNATURE_NCM1 0x316D636E
+
+// wValue of NCM_GET/SET_NTB_FORMAT
+typedef enum
+{
+  NCM_NTB_FORMAT_16 = 0x0000,
+  NCM_NTB_FORMAT_32 = 0x0001,
+} ncm_ntb_format_t;
+
+// wValue of NCM_GET/SET_CRC_MODE
+typedef enum
+{
+  NCM_CRC_MODE_NONE     = 0x0000,
+  NCM_CRC_MODE_APPENDED = 0x0001,
+} ncm_crc_mode_t;
+
 typedef struct TU_ATTR_PACKED {
   uint16_t wLength;
   uint16_t bmNtbFormatsSupported;
@@ -118,6 +172,13 @@ typedef struct TU_ATTR_PACKED {
   uint16_t wNtbOutMaxDatagrams;
 } ntb_parameters_t;
 
+// Data of NCM_GET/SET_NTB_INPUT_SIZE, wNtbInMaxDatagrams only with bmNetworkCapabilities D5
+typedef struct TU_ATTR_PACKED {
+  uint32_t dwNtbInMaxSize;
+  uint16_t wNtbInMaxDatagrams;
+  uint16_t wReserved;
+} ntb_input_size_t;
+
 typedef struct TU_ATTR_PACKED {
   uint32_t dwSignature;
   uint16_t wHeaderLength;
@@ -138,12 +199,39 @@ typedef struct TU_ATTR_PACKED {
   //ndp16_datagram_t datagram[];
 } ndp16_t;
 
+typedef struct TU_ATTR_PACKED {
+  uint32_t dwSignature;
+  uint16_t wHeaderLength;
+  uint16_t wSequence;
+  uint32_t dwBlockLength;
+  uint32_t dwNdpIndex;
+} nth32_t;
+
+typedef struct TU_ATTR_PACKED {
+  uint32_t dwDatagramIndex;
+  uint32_t dwDatagramLength;
+} ndp32_datagram_t;
+
+typedef struct TU_ATTR_PACKED {
+  uint32_t dwSignature;
+  uint16_t wLength;
+  uint16_t wReserved6;
+  uint32_t dwNextNdpIndex;
+  uint32_t dwReserved12;
+  //ndp32_datagram_t datagram[];
+} ndp32_t;
+
 typedef union TU_ATTR_PACKED {
   struct {
     nth16_t nth;
     ndp16_t ndp;
     ndp16_datagram_t ndp_datagram[CFG_TUD_NCM_IN_MAX_DATAGRAMS_PER_NTB + 1];
   };
+  struct {
+    nth32_t nth32;
+    ndp32_t ndp32;
+    ndp32_datagram_t ndp32_datagram[CFG_TUD_NCM_IN_MAX_DATAGRAMS_PER_NTB + 1];
+  };
   uint8_t data[CFG_TUD_NCM_IN_NTB_MAX_SIZE];
 } xmit_ntb_t;
 
@@ -152,6 +240,7 @@ typedef union TU_ATTR_PACKED {
     nth16_t nth;
     // only the header is at a guaranteed position
   };
+  nth32_t nth32;
   uint8_t data[CFG_TUD_NCM_OUT_NTB_MAX_SIZE];
 } recv_ntb_t;
 
@@ -0,0 +1,1647 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Ha Thach (tinyusb.org)
+ * Copyright (c) 2024 Hardy Griech
+ * Copyright (c) 2020 Jacob Berg Potter
+ * Copyright (c) 2020 Peter Lawrence
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * This file is part of the TinyUSB stack.
+ */
+
+/**
+ * Small Glossary (from the spec)
+ * --------------
+ * Datagram - A collection of bytes forming a single item of information, passed as a unit from source to destination.
+ * NCM      - Network Control Model
+ * NDP      - NCM Datagram Pointer: NTB structure that delineates Datagrams (typically Ethernet frames) within an NTB
+ * NTB      - NCM Transfer Block: a data structure for efficient USB encapsulation of one or more datagrams
+ *            Each NTB is designed to be a single USB transfer
+ * NTH      - NTB Header: a data structure at the front of each NTB, which provides the information needed to validate
+ *            the NTB and begin decoding
+ *
+ * Some explanations
+ * -----------------
+ * - rhport        is the USB port of the device, in most cases "0"
+ * - itf_data_alt  if != 0 -> data xmit/recv are allowed (see spec)
+ * - ep_in         IN endpoints take data from the device intended to go in to the host (the device transmits)
+ * - ep_out        OUT endpoints send data out of the host to the device (the device receives)
+ */
+
+#include "tusb_option.h"
+
+#if (CFG_TUD_ENABLED && CFG_TUD_NCM)
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "device/usbd.h"
+#include "device/usbd_pvt.h"
+
+#include "ncm.h"
+#include "net_device.h"
+
+// Level where CFG_TUSB_DEBUG must be at least for this driver is logged
+#ifndef CFG_TUD_NCM_LOG_LEVEL
+  #define CFG_TUD_NCM_LOG_LEVEL   CFG_TUD_LOG_LEVEL
+#endif
+
+#define TU_LOG_DRV(...)   TU_LOG(CFG_TUD_NCM_LOG_LEVEL, __VA_ARGS__)
+
+// Alignment must be 4
+#define TUD_NCM_ALIGNMENT   4
+// calculate alignment of xmit datagrams within an NTB
+#define XMIT_ALIGN_OFFSET(x) ((TUD_NCM_ALIGNMENT - ((x) & (TUD_NCM_ALIGNMENT - 1))) & (TUD_NCM_ALIGNMENT - 1))
+// CRC-32 behind each datagram of an NCM1 NDP
+#define NCM_CRC_LEN         4
+
+//-----------------------------------------------------------------------------
+//
+// Module global things
+//
+#define XMIT_NTB_N CFG_TUD_NCM_IN_NTB_N
+#define RECV_NTB_N CFG_TUD_NCM_OUT_NTB_N
+
+// FIFO of NTB buffer indices (into ncm_epbuf.recv or ncm_epbuf.xmit), each list can hold all buffers
+#define NTB_RING_N TU_MAX(RECV_NTB_N, XMIT_NTB_N)
+typedef struct {
+  uint8_t head;                 // oldest entry
+  uint8_t count;
+  uint8_t ndx[NTB_RING_N];
+} ntb_ring_t;
+
+// position of a datagram within a received NTB
+typedef struct {
+  uint16_t index;
+  uint16_t length;
+} recv_datagram_t;
+
+// datagrams of a received NTB over all its NDPs, collected while validating the NTB
+typedef struct {
+  uint16_t count;
+  recv_datagram_t datagram[CFG_TUD_NCM_OUT_DATAGRAM_TABLE_N];
+} recv_datagram_table_t;
+
+#if CFG_TUD_NCM_XMIT_SG
+// xmit NTB transmitted by reference: NTB header, then per datagram its segments and the alignment padding
+#define XMIT_SG_SEGS_N (1 + CFG_TUD_NCM_IN_MAX_DATAGRAMS_PER_NTB * (CFG_TUD_NCM_XMIT_SG_SEGS_PER_DATAGRAM + 1))
+typedef struct {
+  uint8_t seg_count;
+  uint8_t ref_count;
+  tu_edpt_seg_t seg[XMIT_SG_SEGS_N];                  // IN transfer in order, see usbd_edpt_xfer_sg()
+  void *ref[CFG_TUD_NCM_IN_MAX_DATAGRAMS_PER_NTB];    // datagrams for tud_network_xmit_sg_release_cb()
+} xmit_sg_t;
+#endif
+
+typedef struct {
+  // general
+  uint8_t ep_in;        // endpoint for outgoing datagrams (naming is a little bit confusing)
+  uint8_t ep_out;       // endpoint for incoming datagrams (naming is a little bit confusing)
+  uint8_t ep_notif;     // endpoint for notifications
+  uint8_t itf_num;      // interface number
+  uint8_t itf_data_alt; // ==0 -> no endpoints, i.e. no network traffic, ==1 -> normal operation with two endpoints (spec, chapter 5.3)
+  uint8_t rhport;       // storage of \a rhport because some callbacks are done without it
+  uint16_t ntb_format;  // NCM_NTB_FORMAT_16 or NCM_NTB_FORMAT_32, selected by the host via SET_NTB_FORMAT
+  uint16_t crc_mode;    // NCM_CRC_MODE_NONE or NCM_CRC_MODE_APPENDED (CFG_TUD_NCM_CRC), selected via SET_CRC_MODE
+  uint32_t ntb_in_size;           // IN NTB size selected by the host via SET_NTB_INPUT_SIZE, <= ncm_config.ntb_in_max_size
+  uint16_t ntb_in_max_datagrams;  // IN datagrams per NTB, limited by the host via SET_NTB_INPUT_SIZE
+  ntb_input_size_t ntb_input_size; // data stage of GET/SET_NTB_INPUT_SIZE
+  netd_filter_t filter;           // packet filter and multicast filters selected by the host
+#if CFG_TUD_NET_MC_FILTER_N
+  uint8_t mc_filters[6 * CFG_TUD_NET_MC_FILTER_N]; // data stage of SET_ETHERNET_MULTICAST_FILTERS
+#endif
+
+  // recv handling
+  ntb_ring_t recv_free_ntb;                             // free list of recv NTBs
+  ntb_ring_t recv_ready_ntb;                            // NTBs waiting for transmission to glue logic
+  recv_ntb_t *recv_tinyusb_ntb;                         // buffer for the running transfer TinyUSB -> driver
+  recv_ntb_t *recv_glue_ntb;                            // buffer for the running transfer driver -> glue logic
+  recv_datagram_table_t *recv_glue_table;               // datagram table of \a recv_glue_ntb
+  uint16_t recv_glue_ntb_datagram_ndx;                  // index into \a recv_glue_table
+  tud_network_datagram_t recv_glue_batch[CFG_TUD_NCM_OUT_DATAGRAM_TABLE_N]; // \a recv_glue_table resolved for tud_network_recv_batch_cb()
+  recv_datagram_table_t recv_datagram_table[RECV_NTB_N]; // datagrams of the NTB in ncm_epbuf.recv[i], filled by recv_validate_datagram()
+  bool recv_glue_datagram_pending;                      // datagram handed to glue logic, waiting for tud_network_recv_renew()
+
+  // xmit handling
+  ntb_ring_t xmit_free_ntb;                             // free list of xmit NTBs
+  ntb_ring_t xmit_ready_ntb;                            // NTBs waiting for transmission to TinyUSB
+  xmit_ntb_t *xmit_tinyusb_ntb;                         // buffer for the running transfer driver -> TinyUSB
+  xmit_ntb_t *xmit_glue_ntb;                            // buffer for the running transfer glue logic -> driver
+  uint16_t xmit_sequence;                               // NTB sequence counter
+  uint16_t xmit_glue_ntb_datagram_ndx;                  // index into \a xmit_glue_ntb_datagram
+#if CFG_TUD_NCM_XMIT_SG
+  xmit_sg_t xmit_sg[XMIT_NTB_N];                        // segments and datagram references of ncm_epbuf.xmit[i]
+#endif
+
+  // notification handling
+  enum {
+    NOTIFICATION_SPEED,
+    NOTIFICATION_CONNECTED,
+    NOTIFICATION_DONE
+  } notification_xmit_state;                            // state of notification transmission
+  bool notification_xmit_is_running;                    // notification is currently transmitted
+
+  // misc
+  bool tud_network_recv_renew_active;                   // tud_network_recv_renew() is active (avoid recursive invocations)
+  bool tud_network_recv_renew_process_again;            // tud_network_recv_renew() should process again
+} ncm_interface_t;
+
+typedef struct {
+  struct {
+    TUD_EPBUF_TYPE_DEF(recv_ntb_t, ntb);
+  } recv[RECV_NTB_N];
+
+  struct {
+    TUD_EPBUF_TYPE_DEF(xmit_ntb_t, ntb);
+  } xmit[XMIT_NTB_N];
+
+  TUD_EPBUF_TYPE_DEF(ncm_notify_t, epnotif);
+} ncm_epbuf_t;
+
+static ncm_interface_t ncm_interface;
+CFG_TUD_MEM_SECTION static ncm_epbuf_t ncm_epbuf;
+
+/**
+ * Append buffer index \a ndx to a list with \a size entries.
+ * \return false if the list is full
+ */
+static bool ntb_ring_push(ntb_ring_t *ring, uint8_t size, uint8_t ndx) {
+  if (ring->count >= size) {
+    return false;
+  }
+  uint8_t tail = (uint8_t) (ring->head + ring->count);
+  if (tail >= size) {
+    tail -= size;
+  }
+  ring->ndx[tail] = ndx;
+  ++ring->count;
+  return true;
+} // ntb_ring_push
+
+/**
+ * Remove the oldest buffer index from a list with \a size entries.
+ * \return the index or -1 if the list is empty
+ */
+static int ntb_ring_pop(ntb_ring_t *ring, uint8_t size) {
+  if (ring->count == 0) {
+    return -1;
+  }
+  int ndx = ring->ndx[ring->head];
+  if (++ring->head >= size) {
+    ring->head = 0;
+  }
+  --ring->count;
+  return ndx;
+} // ntb_ring_pop
+
+// runtime NTB configuration, see tud_network_ncm_config().  Not part of ncm_interface because
+// netd_init() clears that on every bus reset.
+static tud_ncm_config_t ncm_config = {
+  .ntb_in_max_size = CFG_TUD_NCM_IN_NTB_MAX_SIZE,
+  .ntb_out_max_size = CFG_TUD_NCM_OUT_NTB_MAX_SIZE,
+  .in_max_datagrams = CFG_TUD_NCM_IN_MAX_DATAGRAMS_PER_NTB,
+  .out_max_datagrams = CFG_TUD_NCM_OUT_MAX_DATAGRAMS_PER_NTB,
+};
+
+// receive statistics, kept over bus resets like \a ncm_config
+static tud_ncm_recv_stats_t recv_stats;
+
+// upstream link reported by the notifications, see tud_network_link_state().  Kept over bus resets
+// like \a ncm_config, speeds of 0 report the USB bus speed.
+static struct {
+  bool connected;
+  uint32_t downlink;
+  uint32_t uplink;
+} link_state = { .connected = true };
+
+// optional application callback, see net_device.h
+TU_ATTR_WEAK void tud_network_xmit_done_cb(void) {
+}
+
+// optional application callback, see net_device.h: default is one datagram per tud_network_recv_cb()
+TU_ATTR_WEAK uint16_t tud_network_recv_batch_cb(const tud_network_datagram_t *datagrams, uint16_t count) {
+  (void) count;
+  return tud_network_recv_cb(datagrams[0].data, datagrams[0].length) ? 1 : 0;
+}
+
+// optional application callback, see net_device.h: default is no hold-off
+TU_ATTR_WEAK bool tud_network_ncm_xmit_holdoff_cb(uint16_t datagrams, uint16_t ntb_len) {
+  (void) datagrams;
+  (void) ntb_len;
+  return false;
+}
+
+// optional application callback, see net_device.h: bit-wise CRC-32 (reflected polynomial 0xEDB88320)
+TU_ATTR_WEAK uint32_t tud_network_ncm_crc32_cb(uint32_t crc, const uint8_t *data, uint16_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *data++;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+    }
+  }
+  return ~crc;
+}
+
+/**
+ * This is the NTB parameter structure, sizes and datagram count are updated from \a ncm_config
+ *
+ * \attention
+ *     We are lucky, that byte order is correct
+ */
+TU_ATTR_ALIGNED(4) static ntb_parameters_t ntb_parameters = {
+  .wLength                  = sizeof(ntb_parameters_t),
+  .bmNtbFormatsSupported    = 0x03,// 16-bit and 32-bit NTB supported
+  .dwNtbInMaxSize           = CFG_TUD_NCM_IN_NTB_MAX_SIZE,
+  .wNdbInDivisor            = 1,
+  .wNdbInPayloadRemainder   = 0,
+  .wNdbInAlignment          = TUD_NCM_ALIGNMENT,
+  .wReserved                = 0,
+  .dwNtbOutMaxSize          = CFG_TUD_NCM_OUT_NTB_MAX_SIZE,
+  .wNdbOutDivisor           = 1,
+  .wNdbOutPayloadRemainder  = 0,
+  .wNdbOutAlignment         = TUD_NCM_ALIGNMENT,
+  .wNtbOutMaxDatagrams      = CFG_TUD_NCM_OUT_MAX_DATAGRAMS_PER_NTB,
+};
+
+// Some confusing remarks about wNtbOutMaxDatagrams...
+//      ==1 -> SystemView packets/s goes up to 2000 and events are lost during startup
+//      ==0 -> SystemView runs fine, iperf shows in wireshark a lot of error
+//      ==6 -> SystemView runs fine, iperf also
+//      >6  -> iperf starts to show errors
+//      -> 6 seems to be the best value.  Why?  Don't know, perhaps only on my system?
+//
+//      iperf:    for MSS in 100 200 400 800 1200 1450 1500; do iperf -c 192.168.14.1 -e -i 1 -M $MSS -l 8192 -P 1; sleep 2; done
+//      sysview:  SYSTICKS_PER_SEC=35000, IDLE_US=1000, PRINT_MOD=1000
+//
+
+//-----------------------------------------------------------------------------
+//
+// everything about notifications
+//
+
+/**
+ * Transmit next notification to the host (if appropriate).
+ * Notifications are transferred to the host during connection setup and on every change of the
+ * link state.
+ */
+static void notification_xmit(uint8_t rhport, bool force_next) {
+  TU_LOG_DRV("notification_xmit(%d, %d) - %d %d\n", force_next, rhport, ncm_interface.notification_xmit_state, ncm_interface.notification_xmit_is_running);
+
+  if (!force_next && ncm_interface.notification_xmit_is_running) {
+    return;
+  }
+
+  if (ncm_interface.notification_xmit_state == NOTIFICATION_SPEED) {
+    TU_LOG_DRV("  NOTIFICATION_SPEED\n");
+    ncm_notify_t notify_speed_change = {
+      .header = {
+        .bmRequestType_bit = {
+          .recipient = TUSB_REQ_RCPT_INTERFACE,
+          .type = TUSB_REQ_TYPE_CLASS,
+          .direction = TUSB_DIR_IN
+        },
+        .bRequest = CDC_NOTIF_CONNECTION_SPEED_CHANGE,
+        .wValue = 0,
+        .wIndex = ncm_interface.itf_num,
+        .wLength = 8
+      }
+    };
+    uint32_t const bus_speed = (tud_speed_get() == TUSB_SPEED_HIGH) ? 480000000 : 12000000;
+    notify_speed_change.downlink = link_state.downlink ? link_state.downlink : bus_speed;
+    notify_speed_change.uplink = link_state.uplink ? link_state.uplink : bus_speed;
+
+    uint16_t notif_len = sizeof(notify_speed_change.header) + notify_speed_change.header.wLength;
+    ncm_epbuf.epnotif = notify_speed_change;
+    usbd_edpt_xfer(rhport, ncm_interface.ep_notif, (uint8_t*) &ncm_epbuf.epnotif, notif_len);
+
+    ncm_interface.notification_xmit_state = NOTIFICATION_CONNECTED;
+    ncm_interface.notification_xmit_is_running = true;
+  } else if (ncm_interface.notification_xmit_state == NOTIFICATION_CONNECTED) {
+    TU_LOG_DRV("  NOTIFICATION_CONNECTED\n");
+    ncm_notify_t notify_connected = {
+      .header = {
+        .bmRequestType_bit = {
+          .recipient = TUSB_REQ_RCPT_INTERFACE,
+          .type = TUSB_REQ_TYPE_CLASS,
+          .direction = TUSB_DIR_IN
+        },
+        .bRequest = CDC_NOTIF_NETWORK_CONNECTION,
+        .wValue = link_state.connected ? 1 : 0,
+        .wIndex = ncm_interface.itf_num,
+        .wLength = 0,
+      },
+    };
+
+    uint16_t notif_len = sizeof(notify_connected.header) + notify_connected.header.wLength;
+    ncm_epbuf.epnotif = notify_connected;
+    usbd_edpt_xfer(rhport, ncm_interface.ep_notif, (uint8_t *) &ncm_epbuf.epnotif, notif_len);
+
+    ncm_interface.notification_xmit_state = NOTIFICATION_DONE;
+    ncm_interface.notification_xmit_is_running = true;
+  } else {
+    TU_LOG_DRV("  NOTIFICATION_FINISHED\n");
+    ncm_interface.notification_xmit_is_running = false;
+  }
+} // notification_xmit
+
+/**
+ * Set the upstream link state reported to the host.
+ * If the data interface is active, the speed and connection notifications are sent again.  A
+ * sequence still in flight is restarted from its completion in netd_xfer_cb().
+ */
+void tud_network_link_state(bool connected, uint32_t downlink, uint32_t uplink) {
+  if (link_state.connected == connected && link_state.downlink == downlink && link_state.uplink == uplink) {
+    return;
+  }
+  link_state.connected = connected;
+  link_state.downlink = downlink;
+  link_state.uplink = uplink;
+
+  if (ncm_interface.itf_data_alt == 1) {
+    ncm_interface.notification_xmit_state = NOTIFICATION_SPEED;
+    notification_xmit(ncm_interface.rhport, false);
+  }
+} // tud_network_link_state
+
+//-----------------------------------------------------------------------------
+//
+// everything about packet transmission (driver -> TinyUSB)
+//
+
+/**
+ * Size of NTH, NDP and datagram table (including terminator) of an xmit NTB in the current format,
+ * i.e. the offset of the first datagram.
+ */
+static uint16_t xmit_header_len(void) {
+  if (ncm_interface.ntb_format == NCM_NTB_FORMAT_32) {
+    return sizeof(nth32_t) + sizeof(ndp32_t) + (CFG_TUD_NCM_IN_MAX_DATAGRAMS_PER_NTB + 1) * sizeof(ndp32_datagram_t);
+  }
+  return sizeof(nth16_t) + sizeof(ndp16_t) + (CFG_TUD_NCM_IN_MAX_DATAGRAMS_PER_NTB + 1) * sizeof(ndp16_datagram_t);
+} // xmit_header_len
+
+/**
+ * Bytes following each xmit datagram: its CRC-32 in CRC mode.
+ */
+static uint16_t xmit_crc_len(void) {
+  return (ncm_interface.crc_mode == NCM_CRC_MODE_APPENDED) ? NCM_CRC_LEN : 0;
+} // xmit_crc_len
+
+/**
+ * Current length of an xmit NTB (NTH block length).
+ */
+static uint32_t xmit_ntb_length(const xmit_ntb_t *ntb) {
+  return (ncm_interface.ntb_format == NCM_NTB_FORMAT_32) ? ntb->nth32.dwBlockLength : ntb->nth.wBlockLength;
+} // xmit_ntb_length
+
+/**
+ * Index of an xmit NTB within \a ncm_epbuf.xmit.
+ */
+static uint8_t xmit_ntb_ndx(const xmit_ntb_t *ntb) {
+  return (uint8_t) (((uintptr_t) ntb - (uintptr_t) &ncm_epbuf.xmit[0]) / sizeof(ncm_epbuf.xmit[0]));
+} // xmit_ntb_ndx
+
+/**
+ * Put NTB into the transmitter free list.
+ */
+static void xmit_put_ntb_into_free_list(xmit_ntb_t *free_ntb) {
+  TU_LOG_DRV("xmit_put_ntb_into_free_list() - %p\n", ncm_interface.xmit_tinyusb_ntb);
+
+  if (free_ntb == NULL) { // can happen due to ZLPs
+    return;
+  }
+
+  if (!ntb_ring_push(&ncm_interface.xmit_free_ntb, XMIT_NTB_N, xmit_ntb_ndx(free_ntb))) {
+    TU_LOG_DRV("(EE) xmit_put_ntb_into_free_list - no entry in free list\n");// this should not happen
+  }
+} // xmit_put_ntb_into_free_list
+
+/**
+ * Get an NTB from the free list
+ */
+static xmit_ntb_t *xmit_get_free_ntb(void) {
+  TU_LOG_DRV("xmit_get_free_ntb()\n");
+
+  int ndx = ntb_ring_pop(&ncm_interface.xmit_free_ntb, XMIT_NTB_N);
+  return (ndx < 0) ? NULL : &ncm_epbuf.xmit[ndx].ntb;
+} // xmit_get_free_ntb
+
+/**
+ * Put a filled NTB into the ready list
+ */
+static void xmit_put_ntb_into_ready_list(xmit_ntb_t *ready_ntb) {
+  TU_LOG_DRV("xmit_put_ntb_into_ready_list(%p) %lu\n", ready_ntb, xmit_ntb_length(ready_ntb));
+
+  if (!ntb_ring_push(&ncm_interface.xmit_ready_ntb, XMIT_NTB_N, xmit_ntb_ndx(ready_ntb))) {
+    TU_LOG_DRV("(EE) xmit_put_ntb_into_ready_list: ready list full\n");// this should not happen
+  }
+} // xmit_put_ntb_into_ready_list
+
+/**
+ * Get the next NTB from the ready list (and remove it from the list).
+ * If the ready list is empty, return NULL.
+ */
+static xmit_ntb_t *xmit_get_next_ready_ntb(void) {
+  int ndx = ntb_ring_pop(&ncm_interface.xmit_ready_ntb, XMIT_NTB_N);
+  xmit_ntb_t *r = (ndx < 0) ? NULL : &ncm_epbuf.xmit[ndx].ntb;
+
+  TU_LOG_DRV("xmit_get_next_ready_ntb: %p\n", r);
+  return r;
+} // xmit_get_next_ready_ntb
+
+/**
+ * Transmit a ZLP if required
+ *
+ * \note
+ *    Insertion of the ZLPs is a little bit different then described in the spec.
+ *    But the below implementation actually works.  Don't know if this is a spec
+ *    or TinyUSB issue.
+ *
+ * \pre
+ *    This must be called from netd_xfer_cb() so that ep_in is ready
+ */
+static bool xmit_insert_required_zlp(uint8_t rhport, uint32_t xferred_bytes) {
+  TU_LOG_DRV("xmit_insert_required_zlp(%d,%ld)\n", rhport, xferred_bytes);
+
+  if (xferred_bytes == 0 || xferred_bytes % CFG_TUD_NET_ENDPOINT_SIZE != 0) {
+    return false;
+  }
+
+  TU_ASSERT(ncm_interface.itf_data_alt == 1, false);
+  TU_ASSERT(!usbd_edpt_busy(rhport, ncm_interface.ep_in), false);
+
+  TU_LOG_DRV("xmit_insert_required_zlp! (%u)\n", (unsigned) xferred_bytes);
+
+  // start transmission of the ZLP
+  usbd_edpt_xfer(rhport, ncm_interface.ep_in, NULL, 0);
+
+  return true;
+} // xmit_insert_required_zlp
+
+/**
+ * Copy the datagram \a ref to \a offset of an xmit NTB, in CRC mode followed by its CRC-32.
+ * \return the datagram length including the CRC
+ */
+static uint16_t xmit_copy_datagram(xmit_ntb_t *ntb, uint32_t offset, void *ref, uint16_t arg) {
+  uint8_t *dst = ntb->data + offset;
+  uint16_t size = tud_network_xmit_cb(dst, ref, arg);
+
+  if (ncm_interface.crc_mode == NCM_CRC_MODE_APPENDED) {
+    uint32_t crc = tud_network_ncm_crc32_cb(0, dst, size);
+    // least significant byte first, like the Ethernet FCS
+    dst[size + 0] = TU_U32_BYTE0(crc);
+    dst[size + 1] = TU_U32_BYTE1(crc);
+    dst[size + 2] = TU_U32_BYTE2(crc);
+    dst[size + 3] = TU_U32_BYTE3(crc);
+    size = (uint16_t) (size + NCM_CRC_LEN);
+  }
+  return size;
+} // xmit_copy_datagram
+
+#if CFG_TUD_NCM_XMIT_SG
+// source of the alignment padding between datagrams
+static const uint8_t xmit_sg_padding[TUD_NCM_ALIGNMENT];
+
+/**
+ * Start the segment list of an empty xmit NTB with its header (NTH, NDP and datagram table).
+ */
+static void xmit_sg_setup(xmit_ntb_t *ntb) {
+  xmit_sg_t *sg = &ncm_interface.xmit_sg[xmit_ntb_ndx(ntb)];
+
+  sg->seg[0].buffer = ntb->data;
+  sg->seg[0].len = xmit_header_len();
+  sg->seg_count = 1;
+  sg->ref_count = 0;
+} // xmit_sg_setup
+
+/**
+ * Append \a len bytes at \a buffer to a segment list, adjacent memory extends the last segment.
+ */
+static void xmit_sg_append(xmit_sg_t *sg, const uint8_t *buffer, uint16_t len) {
+  tu_edpt_seg_t *last = &sg->seg[sg->seg_count - 1];
+
+  if (len == 0) {
+    return;
+  }
+  if (last->buffer + last->len == buffer) {
+    last->len = (uint16_t) (last->len + len);
+    return;
+  }
+  if (sg->seg_count >= XMIT_SG_SEGS_N) {
+    TU_LOG_DRV("(EE) xmit_sg_append: segment list full\n");// must not happen, the list is sized for the worst case
+    return;
+  }
+  sg->seg[sg->seg_count].buffer = buffer;
+  sg->seg[sg->seg_count].len = len;
+  ++sg->seg_count;
+} // xmit_sg_append
+
+/**
+ * Add the datagram \a ref at \a offset of an xmit NTB by reference, or copy it there if the glue logic
+ * can not describe it as segments.
+ * \return the datagram size
+ */
+static uint16_t xmit_sg_datagram(xmit_ntb_t *ntb, uint32_t offset, void *ref, uint16_t arg) {
+  xmit_sg_t *sg = &ncm_interface.xmit_sg[xmit_ntb_ndx(ntb)];
+  tud_network_datagram_t segs[CFG_TUD_NCM_XMIT_SG_SEGS_PER_DATAGRAM];
+  uint16_t size = 0;
+  uint8_t count = 0;
+
+  // in CRC mode the CRC is computed while copying
+  if (ncm_interface.crc_mode == NCM_CRC_MODE_NONE) {
+    count = tud_network_xmit_sg_cb(ref, arg, segs, CFG_TUD_NCM_XMIT_SG_SEGS_PER_DATAGRAM);
+  }
+  if (count == 0 || count > CFG_TUD_NCM_XMIT_SG_SEGS_PER_DATAGRAM) {
+    size = xmit_copy_datagram(ntb, offset, ref, arg);
+    xmit_sg_append(sg, ntb->data + offset, (uint16_t) (size + XMIT_ALIGN_OFFSET(size)));
+    return size;
+  }
+
+  for (uint8_t i = 0; i < count; ++i) {
+    xmit_sg_append(sg, segs[i].data, segs[i].length);
+    size = (uint16_t) (size + segs[i].length);
+  }
+  xmit_sg_append(sg, xmit_sg_padding, XMIT_ALIGN_OFFSET(size));
+  sg->ref[sg->ref_count++] = ref;
+  return size;
+} // xmit_sg_datagram
+
+/**
+ * Hand the datagrams of an xmit NTB back to the glue logic.
+ */
+static void xmit_sg_release(xmit_ntb_t *ntb) {
+  if (ntb == NULL) { // can happen due to ZLPs
+    return;
+  }
+
+  xmit_sg_t *sg = &ncm_interface.xmit_sg[xmit_ntb_ndx(ntb)];
+  for (uint8_t i = 0; i < sg->ref_count; ++i) {
+    tud_network_xmit_sg_release_cb(sg->ref[i]);
+  }
+  sg->ref_count = 0;
+} // xmit_sg_release
+
+/**
+ * Start the gathered transfer of an xmit NTB.  If the DCD can not gather, copy the segments into
+ * the NTB at their offsets instead, release the datagrams and return false for a plain transfer.
+ */
+static bool xmit_sg_start(uint8_t rhport, xmit_ntb_t *ntb, uint16_t len) {
+  xmit_sg_t *sg = &ncm_interface.xmit_sg[xmit_ntb_ndx(ntb)];
+
+  if (usbd_edpt_xfer_sg(rhport, ncm_interface.ep_in, sg->seg, sg->seg_count, len)) {
+    return true;
+  }
+
+  uint32_t offset = 0;
+  for (uint8_t i = 0; i < sg->seg_count; ++i) {
+    if (sg->seg[i].buffer != ntb->data + offset) {
+      memcpy(ntb->data + offset, sg->seg[i].buffer, sg->seg[i].len);
+    }
+    offset += sg->seg[i].len;
+  }
+  xmit_sg_release(ntb);
+  return false;
+} // xmit_sg_start
+#endif
+
+/**
+ * Start transmission if it there is a waiting packet and if can be done from interface side.
+ */
+static void xmit_start_if_possible(uint8_t rhport) {
+  TU_LOG_DRV("xmit_start_if_possible()\n");
+
+  if (ncm_interface.xmit_tinyusb_ntb != NULL) {
+    TU_LOG_DRV("  !xmit_start_if_possible 1\n");
+    return;
+  }
+  if (ncm_interface.itf_data_alt != 1) {
+    TU_LOG_DRV("(EE) !xmit_start_if_possible 2\n");
+    return;
+  }
+  if (usbd_edpt_busy(rhport, ncm_interface.ep_in)) {
+    TU_LOG_DRV("  !xmit_start_if_possible 3\n");
+    return;
+  }
+
+  ncm_interface.xmit_tinyusb_ntb = xmit_get_next_ready_ntb();
+  if (ncm_interface.xmit_tinyusb_ntb == NULL) {
+    if (ncm_interface.xmit_glue_ntb == NULL || ncm_interface.xmit_glue_ntb_datagram_ndx == 0) {
+      // -> really nothing is waiting
+      return;
+    }
+    ncm_interface.xmit_tinyusb_ntb = ncm_interface.xmit_glue_ntb;
+    ncm_interface.xmit_glue_ntb = NULL;
+  }
+
+  uint16_t len = (uint16_t) xmit_ntb_length(ncm_interface.xmit_tinyusb_ntb);
+
+  #if CFG_TUD_NCM_LOG_LEVEL >= 3
+  TU_LOG_BUF(3, ncm_interface.xmit_tinyusb_ntb->data[i], len);
+  #endif
+
+  if (ncm_interface.xmit_glue_ntb_datagram_ndx != 1) {
+    TU_LOG_DRV(">> %d %d\n", len, ncm_interface.xmit_glue_ntb_datagram_ndx);
+  }
+
+  // Kick off an endpoint transfer
+#if CFG_TUD_NCM_XMIT_SG
+  if (xmit_sg_start(rhport, ncm_interface.xmit_tinyusb_ntb, len)) {
+    return;
+  }
+#endif
+  usbd_edpt_xfer(0, ncm_interface.ep_in, ncm_interface.xmit_tinyusb_ntb->data, len);
+} // xmit_start_if_possible
+
+/**
+ * check if a new datagram fits into the current NTB
+ */
+static bool xmit_requested_datagram_fits_into_current_ntb(uint16_t datagram_size) {
+  TU_LOG_DRV("xmit_requested_datagram_fits_into_current_ntb(%d) - %p %p\n", datagram_size, ncm_interface.xmit_tinyusb_ntb, ncm_interface.xmit_glue_ntb);
+
+  if (ncm_interface.xmit_glue_ntb == NULL) {
+    return false;
+  }
+  if (ncm_interface.xmit_glue_ntb_datagram_ndx >= ncm_interface.ntb_in_max_datagrams) {
+    return false;
+  }
+  datagram_size = (uint16_t) (datagram_size + xmit_crc_len());
+  if (xmit_ntb_length(ncm_interface.xmit_glue_ntb) + datagram_size + XMIT_ALIGN_OFFSET(datagram_size) > ncm_interface.ntb_in_size) {
+    return false;
+  }
+  return true;
+} // xmit_requested_datagram_fits_into_current_ntb
+
+/**
+ * Setup an NTB for the glue logic
+ */
+static bool xmit_setup_next_glue_ntb(void) {
+  TU_LOG_DRV("xmit_setup_next_glue_ntb - %p\n", ncm_interface.xmit_glue_ntb);
+
+  if (ncm_interface.xmit_glue_ntb != NULL) {
+    // put NTB into waiting list (the new datagram did not fit in)
+    xmit_put_ntb_into_ready_list(ncm_interface.xmit_glue_ntb);
+  }
+
+  ncm_interface.xmit_glue_ntb = xmit_get_free_ntb();// get next buffer (if any)
+  if (ncm_interface.xmit_glue_ntb == NULL) {
+    TU_LOG_DRV("  xmit_setup_next_glue_ntb - nothing free\n");// should happen rarely
+    return false;
+  }
+
+  ncm_interface.xmit_glue_ntb_datagram_ndx = 0;
+
+  xmit_ntb_t *ntb = ncm_interface.xmit_glue_ntb;
+#if CFG_TUD_NCM_XMIT_SG
+  xmit_sg_setup(ntb);
+#endif
+
+  if (ncm_interface.ntb_format == NCM_NTB_FORMAT_32) {
+    // Fill in NTB header
+    ntb->nth32.dwSignature = NTH32_SIGNATURE;
+    ntb->nth32.wHeaderLength = sizeof(ntb->nth32);
+    ntb->nth32.wSequence = ncm_interface.xmit_sequence++;
+    ntb->nth32.dwBlockLength = sizeof(ntb->nth32) + sizeof(ntb->ndp32) + sizeof(ntb->ndp32_datagram);
+    ntb->nth32.dwNdpIndex = sizeof(ntb->nth32);
+
+    // Fill in NDP32 header and terminator
+    ntb->ndp32.dwSignature = (ncm_interface.crc_mode == NCM_CRC_MODE_APPENDED) ? NDP32_SIGNATURE_NCM1 : NDP32_SIGNATURE_NCM0;
+    ntb->ndp32.wLength = sizeof(ntb->ndp32) + sizeof(ntb->ndp32_datagram);
+    ntb->ndp32.wReserved6 = 0;
+    ntb->ndp32.dwNextNdpIndex = 0;
+    ntb->ndp32.dwReserved12 = 0;
+
+    memset(ntb->ndp32_datagram, 0, sizeof(ntb->ndp32_datagram));
+    return true;
+  }
+
+  // Fill in NTB header
+  ntb->nth.dwSignature = NTH16_SIGNATURE;
+  ntb->nth.wHeaderLength = sizeof(ntb->nth);
+  ntb->nth.wSequence = ncm_interface.xmit_sequence++;
+  ntb->nth.wBlockLength = sizeof(ntb->nth) + sizeof(ntb->ndp) + sizeof(ntb->ndp_datagram);
+  ntb->nth.wNdpIndex = sizeof(ntb->nth);
+
+  // Fill in NDP16 header and terminator
+  ntb->ndp.dwSignature = (ncm_interface.crc_mode == NCM_CRC_MODE_APPENDED) ? NDP16_SIGNATURE_NCM1 : NDP16_SIGNATURE_NCM0;
+  ntb->ndp.wLength = sizeof(ntb->ndp) + sizeof(ntb->ndp_datagram);
+  ntb->ndp.wNextNdpIndex = 0;
+
+  memset(ntb->ndp_datagram, 0, sizeof(ntb->ndp_datagram));
+  return true;
+} // xmit_setup_next_glue_ntb
+
+//-----------------------------------------------------------------------------
+//
+// all the recv_*() stuff (TinyUSB -> driver -> glue logic)
+//
+
+/**
+ * Index of a recv NTB within \a ncm_epbuf.recv.
+ */
+static uint8_t recv_ntb_ndx(const recv_ntb_t *ntb) {
+  return (uint8_t) (((uintptr_t) ntb - (uintptr_t) &ncm_epbuf.recv[0]) / sizeof(ncm_epbuf.recv[0]));
+} // recv_ntb_ndx
+
+/**
+ * Return pointer to an available receive buffer or NULL.
+ * Returned buffer (if any) has the size \a CFG_TUD_NCM_OUT_NTB_MAX_SIZE, transfers use \a ncm_config.ntb_out_max_size of it.
+ */
+static recv_ntb_t *recv_get_free_ntb(void) {
+  TU_LOG_DRV("recv_get_free_ntb()\n");
+
+  int ndx = ntb_ring_pop(&ncm_interface.recv_free_ntb, RECV_NTB_N);
+  return (ndx < 0) ? NULL : &ncm_epbuf.recv[ndx].ntb;
+} // recv_get_free_ntb
+
+/**
+ * Get the next NTB from the ready list (and remove it from the list).
+ * If the ready list is empty, return NULL.
+ */
+static recv_ntb_t *recv_get_next_ready_ntb(void) {
+  int ndx = ntb_ring_pop(&ncm_interface.recv_ready_ntb, RECV_NTB_N);
+  recv_ntb_t *r = (ndx < 0) ? NULL : &ncm_epbuf.recv[ndx].ntb;
+
+  TU_LOG_DRV("recv_get_next_ready_ntb: %p\n", r);
+  return r;
+} // recv_get_next_ready_ntb
+
+/**
+ * Put NTB into the receiver free list.
+ */
+static void recv_put_ntb_into_free_list(recv_ntb_t *free_ntb) {
+  TU_LOG_DRV("recv_put_ntb_into_free_list(%p)\n", free_ntb);
+
+  if (!ntb_ring_push(&ncm_interface.recv_free_ntb, RECV_NTB_N, recv_ntb_ndx(free_ntb))) {
+    TU_LOG_DRV("(EE) recv_put_ntb_into_free_list - no entry in free list\n");// this should not happen
+  }
+} // recv_put_ntb_into_free_list
+
+/**
+ * \a ready_ntb holds a validated NTB,
+ * put this buffer into the waiting list.
+ */
+static void recv_put_ntb_into_ready_list(recv_ntb_t *ready_ntb) {
+  TU_LOG_DRV("recv_put_ntb_into_ready_list(%p)\n", ready_ntb);
+
+  if (!ntb_ring_push(&ncm_interface.recv_ready_ntb, RECV_NTB_N, recv_ntb_ndx(ready_ntb))) {
+    TU_LOG_DRV("(EE) recv_put_ntb_into_ready_list: ready list full\n");// this should not happen
+  }
+} // recv_put_ntb_into_ready_list
+
+#if CFG_TUD_NCM_CHECK_LISTS
+/**
+ * Mark the buffer indices of a list in \a seen, each index may show up only once.
+ */
+static bool ntb_ring_collect(const ntb_ring_t *ring, uint8_t size, uint8_t *seen) {
+  TU_ASSERT(ring->head < size && ring->count <= size);
+  uint8_t pos = ring->head;
+  for (uint8_t i = 0; i < ring->count; ++i) {
+    uint8_t ndx = ring->ndx[pos];
+    TU_ASSERT(ndx < size && !seen[ndx]);
+    seen[ndx] = 1;
+    if (++pos >= size) {
+      pos = 0;
+    }
+  }
+  return true;
+} // ntb_ring_collect
+
+/**
+ * Every NTB buffer must be in exactly one place: in the free or ready list, or held by TinyUSB or by the glue logic.
+ */
+static bool ntb_lists_valid(void) {
+  uint8_t seen[NTB_RING_N];
+
+  memset(seen, 0, sizeof(seen));
+  TU_ASSERT(ntb_ring_collect(&ncm_interface.recv_free_ntb, RECV_NTB_N, seen));
+  TU_ASSERT(ntb_ring_collect(&ncm_interface.recv_ready_ntb, RECV_NTB_N, seen));
+  if (ncm_interface.recv_tinyusb_ntb != NULL) {
+    TU_ASSERT(!seen[recv_ntb_ndx(ncm_interface.recv_tinyusb_ntb)]);
+    seen[recv_ntb_ndx(ncm_interface.recv_tinyusb_ntb)] = 1;
+  }
+  if (ncm_interface.recv_glue_ntb != NULL) {
+    TU_ASSERT(!seen[recv_ntb_ndx(ncm_interface.recv_glue_ntb)]);
+    seen[recv_ntb_ndx(ncm_interface.recv_glue_ntb)] = 1;
+  }
+  for (int i = 0; i < RECV_NTB_N; ++i) {
+    TU_ASSERT(seen[i]);// lost recv NTB
+  }
+
+  memset(seen, 0, sizeof(seen));
+  TU_ASSERT(ntb_ring_collect(&ncm_interface.xmit_free_ntb, XMIT_NTB_N, seen));
+  TU_ASSERT(ntb_ring_collect(&ncm_interface.xmit_ready_ntb, XMIT_NTB_N, seen));
+  if (ncm_interface.xmit_tinyusb_ntb != NULL) {
+    TU_ASSERT(!seen[xmit_ntb_ndx(ncm_interface.xmit_tinyusb_ntb)]);
+    seen[xmit_ntb_ndx(ncm_interface.xmit_tinyusb_ntb)] = 1;
+  }
+  if (ncm_interface.xmit_glue_ntb != NULL) {
+    TU_ASSERT(!seen[xmit_ntb_ndx(ncm_interface.xmit_glue_ntb)]);
+    seen[xmit_ntb_ndx(ncm_interface.xmit_glue_ntb)] = 1;
+  }
+  for (int i = 0; i < XMIT_NTB_N; ++i) {
+    TU_ASSERT(seen[i]);// lost xmit NTB
+  }
+  return true;
+} // ntb_lists_valid
+
+  #define NTB_LISTS_CHECK() (void) ntb_lists_valid()
+#else
+  #define NTB_LISTS_CHECK() do {} while (0)
+#endif
+
+/**
+ * If possible, start a new reception TinyUSB -> driver.
+ */
+static void recv_try_to_start_new_reception(uint8_t rhport) {
+  TU_LOG_DRV("recv_try_to_start_new_reception(%d)\n", rhport);
+
+  if (ncm_interface.itf_data_alt != 1) {
+    return;
+  }
+  if (ncm_interface.recv_tinyusb_ntb != NULL) {
+    return;
+  }
+  if (usbd_edpt_busy(rhport, ncm_interface.ep_out)) {
+    return;
+  }
+
+  ncm_interface.recv_tinyusb_ntb = recv_get_free_ntb();
+  if (ncm_interface.recv_tinyusb_ntb == NULL) {
+    return;
+  }
+
+  // initiate transfer
+  TU_LOG_DRV("  start reception\n");
+  bool r = usbd_edpt_xfer(rhport, ncm_interface.ep_out, ncm_interface.recv_tinyusb_ntb->data, (uint16_t) ncm_config.ntb_out_max_size);
+  if (!r) {
+    recv_put_ntb_into_free_list(ncm_interface.recv_tinyusb_ntb);
+    ncm_interface.recv_tinyusb_ntb = NULL;
+  }
+} // recv_try_to_start_new_reception
+
+/**
+ * Datagram table belonging to a receive NTB buffer.
+ */
+static recv_datagram_table_t *recv_datagram_table(const recv_ntb_t *ntb) {
+  return &ncm_interface.recv_datagram_table[recv_ntb_ndx(ntb)];
+} // recv_datagram_table
+
+/**
+ * Check the CRC-32 in the last four bytes (least significant first) of a datagram from an NCM1 NDP.
+ */
+static bool recv_datagram_crc_valid(const uint8_t *datagram, uint16_t length) {
+  const uint8_t *crc = datagram + length - NCM_CRC_LEN;
+
+  return tud_network_ncm_crc32_cb(0, datagram, (uint16_t) (length - NCM_CRC_LEN)) == tu_u32(crc[3], crc[2], crc[1], crc[0]);
+} // recv_datagram_crc_valid
+
+/**
+ * Validate an incoming NTB and collect its datagrams into the datagram table of the NTB.
+ * The NTB must use the format selected with SET_NTB_FORMAT (NTB16 by default).
+ * The NDP chain is walked once, bounded by \a CFG_TUD_NCM_OUT_MAX_NDPS_PER_NTB, every NDP and every
+ * datagram is checked against the block length.  Rejected NTBs are counted per reason in \a recv_stats,
+ * datagrams of NCM1 NDPs are checked against their CRC-32 and dropped (only them) if it does not match.
+ * \return true if valid
+ */
+static bool recv_validate_datagram(const recv_ntb_t *ntb, uint32_t len) {
+  const bool ntb32 = (ncm_interface.ntb_format == NCM_NTB_FORMAT_32);
+  const uint32_t nth_size = ntb32 ? sizeof(nth32_t) : sizeof(nth16_t);
+  const uint32_t ndp_size = ntb32 ? sizeof(ndp32_t) : sizeof(ndp16_t);
+  const uint32_t entry_size = ntb32 ? sizeof(ndp32_datagram_t) : sizeof(ndp16_datagram_t);
+  recv_datagram_table_t *table = recv_datagram_table(ntb);
+  uint32_t block_length;
+  uint32_t ndp_index;
+
+  TU_LOG_DRV("recv_validate_datagram(%p, %d)\n", ntb, (int) len);
+
+  table->count = 0;
+
+  // check header
+  if (ntb32) {
+    if (ntb->nth32.wHeaderLength != sizeof(nth32_t)) {
+      TU_LOG_DRV("(EE) ill nth32 length: %d\n", ntb->nth32.wHeaderLength);
+      ++recv_stats.drop_nth;
+      return false;
+    }
+    if (ntb->nth32.dwSignature != NTH32_SIGNATURE) {
+      TU_LOG_DRV("(EE) ill signature: 0x%08x\n", (unsigned) ntb->nth32.dwSignature);
+      ++recv_stats.drop_nth;
+      return false;
+    }
+    block_length = ntb->nth32.dwBlockLength;
+    ndp_index = ntb->nth32.dwNdpIndex;
+  } else {
+    if (ntb->nth.wHeaderLength != sizeof(nth16_t)) {
+      TU_LOG_DRV("(EE) ill nth16 length: %d\n", ntb->nth.wHeaderLength);
+      ++recv_stats.drop_nth;
+      return false;
+    }
+    if (ntb->nth.dwSignature != NTH16_SIGNATURE) {
+      TU_LOG_DRV("(EE) ill signature: 0x%08x\n", (unsigned) ntb->nth.dwSignature);
+      ++recv_stats.drop_nth;
+      return false;
+    }
+    block_length = ntb->nth.wBlockLength;
+    ndp_index = ntb->nth.wNdpIndex;
+  }
+  if (len < nth_size + ndp_size + 2 * entry_size) {
+    TU_LOG_DRV("(EE) ill min len: %lu\n", len);
+    ++recv_stats.drop_nth;
+    return false;
+  }
+  if (block_length == 0) {
+    // spec 3.2.1: NTB16 with wBlockLength==0 is terminated by a short packet
+    block_length = len;
+  }
+  if (block_length > len || block_length > ncm_config.ntb_out_max_size) {
+    TU_LOG_DRV("(EE) ill block length: %lu > %lu\n", block_length, len);
+    ++recv_stats.drop_nth;
+    return false;
+  }
+
+  // walk the NDP chain
+  for (int ndps = 0; ndp_index != 0; ++ndps) {
+    if (ndps >= CFG_TUD_NCM_OUT_MAX_NDPS_PER_NTB) {
+      TU_LOG_DRV("(EE) too many NDPs\n");
+      ++recv_stats.drop_ndp_chain;
+      return false;
+    }
+    if (ndp_index < nth_size || ndp_index > block_length - (ndp_size + 2 * entry_size)) {
+      TU_LOG_DRV("(EE) ill position of ndp: %lu (%lu)\n", ndp_index, block_length);
+      ++recv_stats.drop_ndp;
+      return false;
+    }
+
+    const uint8_t *ndp = ntb->data + ndp_index;
+    uint32_t ndp_signature;
+    uint32_t next_ndp_index;
+    uint16_t ndp_length;
+    if (ntb32) {
+      const ndp32_t *ndp32 = (const ndp32_t *) ndp;
+      ndp_signature = ndp32->dwSignature;
+      ndp_length = ndp32->wLength;
+      next_ndp_index = ndp32->dwNextNdpIndex;
+    } else {
+      const ndp16_t *ndp16 = (const ndp16_t *) ndp;
+      ndp_signature = ndp16->dwSignature;
+      ndp_length = ndp16->wLength;
+      next_ndp_index = ndp16->wNextNdpIndex;
+    }
+
+    if (ndp_length < ndp_size + 2 * entry_size || ndp_index + ndp_length > block_length) {
+      TU_LOG_DRV("(EE) ill ndp length: %d\n", ndp_length);
+      ++recv_stats.drop_ndp;
+      return false;
+    }
+    if (ntb32 ? (ndp_signature != NDP32_SIGNATURE_NCM0 && ndp_signature != NDP32_SIGNATURE_NCM1)
+              : (ndp_signature != NDP16_SIGNATURE_NCM0 && ndp_signature != NDP16_SIGNATURE_NCM1)) {
+      TU_LOG_DRV("(EE) ill signature: 0x%08x\n", (unsigned) ndp_signature);
+      ++recv_stats.drop_ndp;
+      return false;
+    }
+    const bool ndp_crc = ntb32 ? (ndp_signature == NDP32_SIGNATURE_NCM1) : (ndp_signature == NDP16_SIGNATURE_NCM1);
+
+    // datagram pointers up to the terminating null entry, which must lie within the NDP
+    const uint16_t max_ndx = (uint16_t) ((ndp_length - ndp_size) / entry_size);
+    for (uint16_t ndx = 0;; ++ndx) {
+      uint32_t datagram_index;
+      uint32_t datagram_length;
+
+      if (ndx >= max_ndx) {
+        TU_LOG_DRV("(EE) ndp without terminator\n");
+        ++recv_stats.drop_ndp;
+        return false;
+      }
+      if (ntb32) {
+        const ndp32_datagram_t *entry = (const ndp32_datagram_t *) (ndp + ndp_size) + ndx;
+        datagram_index = entry->dwDatagramIndex;
+        datagram_length = entry->dwDatagramLength;
+      } else {
+        const ndp16_datagram_t *entry = (const ndp16_datagram_t *) (ndp + ndp_size) + ndx;
+        datagram_index = entry->wDatagramIndex;
+        datagram_length = entry->wDatagramLength;
+      }
+      if (datagram_index == 0 || datagram_length == 0) {
+        break;
+      }
+
+      TU_LOG_DRV("  << %lu %lu\n", datagram_index, datagram_length);
+      if (datagram_index < nth_size || datagram_index > block_length || datagram_length > block_length - datagram_index) {
+        TU_LOG_DRV("(EE) ill datagram[%d]: %lu %lu (%lu)\n", table->count, datagram_index, datagram_length, block_length);
+        ++recv_stats.drop_datagram;
+        return false;
+      }
+      if (table->count >= CFG_TUD_NCM_OUT_DATAGRAM_TABLE_N) {
+        TU_LOG_DRV("(EE) datagram table full\n");
+        ++recv_stats.drop_table_full;
+        return false;
+      }
+      if (ndp_crc) {
+        // NCM1: the datagram ends with its CRC-32, a bad one drops just this datagram
+        if (datagram_length <= NCM_CRC_LEN || !recv_datagram_crc_valid(ntb->data + datagram_index, (uint16_t) datagram_length)) {
+          TU_LOG_DRV("(EE) crc datagram[%d]\n", table->count);
+          ++recv_stats.drop_crc;
+          continue;
+        }
+        datagram_length -= NCM_CRC_LEN;
+      }
+      // block_length <= ntb_out_max_size <= UINT16_MAX, see tud_network_ncm_config()
+      table->datagram[table->count].index = (uint16_t) datagram_index;
+      table->datagram[table->count].length = (uint16_t) datagram_length;
+      ++table->count;
+    }
+
+    ndp_index = next_ndp_index;
+  }
+
+  if (table->count > 1) {
+    TU_LOG_DRV("<< %d (%lu)\n", table->count, block_length);
+  }
+
+  #if CFG_TUD_NCM_LOG_LEVEL >= 3
+  TU_LOG_BUF(3, ntb->data[i], len);
+  #endif
+
+  // -> ntb contains a valid packet structure
+  //    ok... I did not check for garbage within the datagrams...
+  ++recv_stats.ntbs;
+  recv_stats.datagrams += table->count;
+  return true;
+} // recv_validate_datagram
+
+/**
+ * Offer the pending datagrams of the current NTB to the glue logic and return receive buffer if empty.
+ *
+ * \note
+ *    The glue logic may keep referencing the consumed datagrams (e.g. zero-copy into its network stack)
+ *    until it calls tud_network_recv_renew().  So an NTB is returned to the free list only
+ *    after the last datagram has been released, not when it has been handed out.
+ */
+static void recv_transfer_datagram_to_glue_logic(void) {
+  TU_LOG_DRV("recv_transfer_datagram_to_glue_logic()\n");
+
+  if (ncm_interface.recv_glue_datagram_pending) {
+    TU_LOG_DRV("  glue logic still holds previous datagram\n");
+    return;
+  }
+
+  if (ncm_interface.recv_glue_ntb != NULL && ncm_interface.recv_glue_ntb_datagram_ndx >= ncm_interface.recv_glue_table->count) {
+    // end of datagrams reached and all of them released by the glue logic
+    recv_put_ntb_into_free_list(ncm_interface.recv_glue_ntb);
+    ncm_interface.recv_glue_ntb = NULL;
+  }
+
+  while (ncm_interface.recv_glue_ntb == NULL) {
+    ncm_interface.recv_glue_ntb = recv_get_next_ready_ntb();
+    TU_LOG_DRV("  new buffer for glue logic: %p\n", ncm_interface.recv_glue_ntb);
+    if (ncm_interface.recv_glue_ntb == NULL) {
+      return;
+    }
+    ncm_interface.recv_glue_table = recv_datagram_table(ncm_interface.recv_glue_ntb);
+    ncm_interface.recv_glue_ntb_datagram_ndx = 0;
+    if (ncm_interface.recv_glue_table->count == 0) {
+      // valid but empty NTB
+      recv_put_ntb_into_free_list(ncm_interface.recv_glue_ntb);
+      ncm_interface.recv_glue_ntb = NULL;
+    }
+  }
+
+  if (ncm_interface.recv_glue_ntb_datagram_ndx == 0) {
+    // first offer of this NTB: resolve the datagram table into pointers once
+    for (uint16_t i = 0; i < ncm_interface.recv_glue_table->count; ++i) {
+      ncm_interface.recv_glue_batch[i].data = ncm_interface.recv_glue_ntb->data + ncm_interface.recv_glue_table->datagram[i].index;
+      ncm_interface.recv_glue_batch[i].length = ncm_interface.recv_glue_table->datagram[i].length;
+    }
+  }
+
+  const uint16_t ndx = ncm_interface.recv_glue_ntb_datagram_ndx;
+  const uint16_t count = (uint16_t) (ncm_interface.recv_glue_table->count - ndx);
+
+  TU_LOG_DRV("  recv[%d] - %u datagrams\n", ndx, count);
+
+  // mark pending before the callback, the glue logic may call tud_network_recv_renew() from within
+  ncm_interface.recv_glue_datagram_pending = true;
+  uint16_t consumed = tud_network_recv_batch_cb(ncm_interface.recv_glue_batch + ndx, count);
+  if (consumed != 0) {
+    // send datagrams successfully to glue logic
+    TU_LOG_DRV("    OK %u\n", consumed);
+    ncm_interface.recv_glue_ntb_datagram_ndx += tu_min16(consumed, count);
+  } else {
+    // glue logic refused the datagram, offer it again on the next renew
+    ncm_interface.recv_glue_datagram_pending = false;
+  }
+} // recv_transfer_datagram_to_glue_logic
+
+//-----------------------------------------------------------------------------
+//
+// all the tud_network_*() stuff (glue logic -> driver)
+//
+
+/**
+ * Check if the glue logic is allowed to call tud_network_xmit().
+ * This function also fetches a next buffer if required, so that tud_network_xmit() is ready for copy
+ * and transmission operation.
+ */
+bool tud_network_can_xmit(uint16_t size) {
+  TU_LOG_DRV("tud_network_can_xmit(%d)\n", size);
+  NTB_LISTS_CHECK();
+
+  TU_ASSERT(size + xmit_crc_len() <= ncm_interface.ntb_in_size - xmit_header_len(), false);
+
+  if (xmit_requested_datagram_fits_into_current_ntb(size) || xmit_setup_next_glue_ntb()) {
+    // -> everything is fine
+    return true;
+  }
+  xmit_start_if_possible(ncm_interface.rhport);
+  TU_LOG_DRV("(II) tud_network_can_xmit: request blocked\n");// could happen if all xmit buffers are full (but should happen rarely)
+  return false;
+} // tud_network_can_xmit
+
+/**
+ * Put a datagram into a waiting NTB.
+ * If currently no transmission is started, then initiate transmission.
+ */
+void tud_network_xmit(void *ref, uint16_t arg) {
+  TU_LOG_DRV("tud_network_xmit(%p, %d)\n", ref, arg);
+  NTB_LISTS_CHECK();
+
+  if (ncm_interface.xmit_glue_ntb == NULL) {
+    TU_LOG_DRV("(EE) tud_network_xmit: no buffer\n");// must not happen (really)
+    return;
+  }
+
+  xmit_ntb_t *ntb = ncm_interface.xmit_glue_ntb;
+  uint32_t block_length = xmit_ntb_length(ntb);
+
+#if CFG_TUD_NCM_XMIT_SG
+  // reference the datagram behind the current end of the NTB
+  uint16_t size = xmit_sg_datagram(ntb, block_length, ref, arg);
+#else
+  // copy new datagram to the end of the current NTB
+  uint16_t size = xmit_copy_datagram(ntb, block_length, ref, arg);
+#endif
+
+  // correct NTB internals
+  if (ncm_interface.ntb_format == NCM_NTB_FORMAT_32) {
+    ntb->ndp32_datagram[ncm_interface.xmit_glue_ntb_datagram_ndx].dwDatagramIndex = block_length;
+    ntb->ndp32_datagram[ncm_interface.xmit_glue_ntb_datagram_ndx].dwDatagramLength = size;
+  } else {
+    ntb->ndp_datagram[ncm_interface.xmit_glue_ntb_datagram_ndx].wDatagramIndex = (uint16_t) block_length;
+    ntb->ndp_datagram[ncm_interface.xmit_glue_ntb_datagram_ndx].wDatagramLength = size;
+  }
+  ncm_interface.xmit_glue_ntb_datagram_ndx += 1;
+
+  block_length += (uint32_t) (size + XMIT_ALIGN_OFFSET(size));
+  if (ncm_interface.ntb_format == NCM_NTB_FORMAT_32) {
+    ntb->nth32.dwBlockLength = block_length;
+  } else {
+    ntb->nth.wBlockLength = (uint16_t) block_length;
+  }
+
+  if (block_length > ncm_interface.ntb_in_size) {
+    TU_LOG_DRV("(EE) tud_network_xmit: buffer overflow\n"); // must not happen (really)
+    return;
+  }
+
+  // the glue logic may keep a partially filled NTB back to aggregate more datagrams,
+  // it is then responsible for tud_network_ncm_xmit_flush()
+  if (tud_network_ncm_xmit_holdoff_cb(ncm_interface.xmit_glue_ntb_datagram_ndx, (uint16_t) block_length)) {
+    TU_LOG_DRV("  tud_network_xmit: hold-off\n");
+    return;
+  }
+  xmit_start_if_possible(ncm_interface.rhport);
+} // tud_network_xmit
+
+/**
+ * Host selected packet and multicast filters, for the glue logic to apply before tud_network_xmit().
+ */
+bool tud_network_filter_accepts(const uint8_t *dst) {
+  return netd_filter_accepts(&ncm_interface.filter, dst);
+} // tud_network_filter_accepts
+
+/**
+ * Start transmission of a partially filled NTB kept back by tud_network_ncm_xmit_holdoff_cb().
+ * No-op if a transfer is running (the NTB goes out when it completes) or nothing is waiting.
+ */
+void tud_network_ncm_xmit_flush(void) {
+  TU_LOG_DRV("tud_network_ncm_xmit_flush()\n");
+
+  xmit_start_if_possible(ncm_interface.rhport);
+} // tud_network_ncm_xmit_flush
+
+/**
+ * Keep the receive logic busy and transfer pending packets to the glue logic.
+ * Avoid recursive calls due to wrong expectations of the net glue logic,
+ * see https://github.com/hathach/tinyusb/issues/2711
+ *
+ * Does not release the datagram currently held by the glue logic.
+ */
+static void recv_renew_process(void) {
+  ncm_interface.tud_network_recv_renew_process_again = true;
+
+  if (ncm_interface.tud_network_recv_renew_active) {
+    TU_LOG_DRV("Re-entrant into tud_network_recv_renew, will process later\n");
+    return;
+  }
+
+  while (ncm_interface.tud_network_recv_renew_process_again) {
+    ncm_interface.tud_network_recv_renew_process_again = false;
+
+    // If the current function is called within recv_transfer_datagram_to_glue_logic,
+    // tud_network_recv_renew_process_again will become true, and the loop will run again
+    // Otherwise the loop will not run again
+    ncm_interface.tud_network_recv_renew_active = true;
+    recv_transfer_datagram_to_glue_logic();
+    ncm_interface.tud_network_recv_renew_active = false;
+  }
+  recv_try_to_start_new_reception(ncm_interface.rhport);
+} // recv_renew_process
+
+/**
+ * The glue logic has finished with the datagram provided to tud_network_recv_cb():
+ * release it and transfer the next one (if any).
+ */
+void tud_network_recv_renew(void) {
+  TU_LOG_DRV("tud_network_recv_renew()\n");
+  NTB_LISTS_CHECK();
+
+  ncm_interface.recv_glue_datagram_pending = false;
+  recv_renew_process();
+} // tud_network_recv_renew
+
+/**
+ * Same as recv_renew_process() but knows \a rhport.
+ * Used by the driver itself, so a datagram still held by the glue logic is not released.
+ */
+static void tud_network_recv_renew_r(uint8_t rhport) {
+  TU_LOG_DRV("tud_network_recv_renew_r(%d)\n", rhport);
+
+  ncm_interface.rhport = rhport;
+  recv_renew_process();
+} // tud_network_recv_renew_r
+
+/**
+ * Return to the IN NTB size and datagram count announced in the NTB parameters (spec 7.2).
+ */
+static void ntb_input_size_reset(void) {
+  ncm_interface.ntb_in_size = ncm_config.ntb_in_max_size;
+  ncm_interface.ntb_in_max_datagrams = ncm_config.in_max_datagrams;
+} // ntb_input_size_reset
+
+/**
+ * Apply the data stage of SET_NTB_INPUT_SIZE.
+ * The size must hold a full size datagram and must not exceed the announced dwNtbInMaxSize,
+ * wNtbInMaxDatagrams (if sent) further limits the datagrams per NTB, 0 means no limit.
+ * An NTB already being filled is sent as is, the new values apply to the following ones.
+ * \return false if the values are not acceptable (the request is stalled)
+ */
+static bool ntb_input_size_set(uint16_t length) {
+  const ntb_input_size_t *input_size = &ncm_interface.ntb_input_size;
+
+  TU_LOG_DRV("ntb_input_size_set(%u) - %lu %u\n", length, input_size->dwNtbInMaxSize, input_size->wNtbInMaxDatagrams);
+
+  TU_VERIFY(input_size->dwNtbInMaxSize >= (uint32_t) xmit_header_len() + CFG_TUD_NET_MTU + xmit_crc_len() &&
+            input_size->dwNtbInMaxSize <= ncm_config.ntb_in_max_size);
+
+  ncm_interface.ntb_in_size = input_size->dwNtbInMaxSize;
+  ncm_interface.ntb_in_max_datagrams = ncm_config.in_max_datagrams;
+  if (length >= sizeof(ntb_input_size_t) && input_size->wNtbInMaxDatagrams != 0) {
+    ncm_interface.ntb_in_max_datagrams = tu_min16(input_size->wNtbInMaxDatagrams, ncm_config.in_max_datagrams);
+  }
+  return true;
+} // ntb_input_size_set
+
+/**
+ * Select NTB sizes and datagram counts at runtime.
+ * Values are limited by the compile time buffer sizes.  Only accepted while the data interface is
+ * inactive, because the host reads the NTB parameters once before it selects the active alternate
+ * setting.
+ */
+bool tud_network_ncm_config(tud_ncm_config_t const *cfg) {
+  TU_VERIFY(cfg != NULL && ncm_interface.itf_data_alt == 0);
+  // minimum: one MTU sized datagram in an NTB16 (NTB32 is refused by SET_NTB_FORMAT if it does not fit),
+  // maximum: buffer size and the 16-bit transfer length of usbd_edpt_xfer()
+  TU_VERIFY(cfg->ntb_in_max_size >= sizeof(nth16_t) + sizeof(ndp16_t) + 2 * sizeof(ndp16_datagram_t) + CFG_TUD_NET_MTU &&
+            cfg->ntb_in_max_size <= CFG_TUD_NCM_IN_NTB_MAX_SIZE && cfg->ntb_in_max_size <= UINT16_MAX);
+  TU_VERIFY(cfg->ntb_out_max_size >= sizeof(nth16_t) + sizeof(ndp16_t) + 2 * sizeof(ndp16_datagram_t) + CFG_TUD_NET_MTU &&
+            cfg->ntb_out_max_size <= CFG_TUD_NCM_OUT_NTB_MAX_SIZE && cfg->ntb_out_max_size <= UINT16_MAX);
+  TU_VERIFY(cfg->in_max_datagrams >= 1 && cfg->in_max_datagrams <= CFG_TUD_NCM_IN_MAX_DATAGRAMS_PER_NTB);
+  // 0 ("no limit") is not possible, NTBs with more datagrams than the table holds are dropped
+  TU_VERIFY(cfg->out_max_datagrams >= 1 && cfg->out_max_datagrams <= CFG_TUD_NCM_OUT_DATAGRAM_TABLE_N);
+
+  ncm_config = *cfg;
+  ntb_input_size_reset();
+  ntb_parameters.dwNtbInMaxSize = ncm_config.ntb_in_max_size;
+  ntb_parameters.dwNtbOutMaxSize = ncm_config.ntb_out_max_size;
+  ntb_parameters.wNtbOutMaxDatagrams = ncm_config.out_max_datagrams;
+  return true;
+} // tud_network_ncm_config
+
+/**
+ * Copy the receive statistics.
+ */
+void tud_network_ncm_recv_stats(tud_ncm_recv_stats_t *stats) {
+  *stats = recv_stats;
+} // tud_network_ncm_recv_stats
+
+//-----------------------------------------------------------------------------
+//
+// all the netd_*() stuff (interface TinyUSB -> driver)
+//
+/**
+ * Initialize the driver data structures.
+ * Might be called several times.
+ */
+void netd_init(void) {
+  TU_LOG_DRV("netd_init()\n");
+
+#if CFG_TUD_NCM_XMIT_SG
+  // datagrams still referenced by NTBs of the previous session
+  for (uint8_t i = 0; i < XMIT_NTB_N; ++i) {
+    xmit_sg_release(&ncm_epbuf.xmit[i].ntb);
+  }
+#endif
+  memset(&ncm_interface, 0, sizeof(ncm_interface));
+  ntb_input_size_reset();
+
+  for (uint8_t i = 0; i < XMIT_NTB_N; ++i) {
+    ntb_ring_push(&ncm_interface.xmit_free_ntb, XMIT_NTB_N, i);
+  }
+  for (uint8_t i = 0; i < RECV_NTB_N; ++i) {
+    ntb_ring_push(&ncm_interface.recv_free_ntb, RECV_NTB_N, i);
+  }
+} // netd_init
+
+/**
+ * Deinit driver
+ */
+bool netd_deinit(void) {
+  return true;
+}
+
+/**
+ * Resets the port.
+ * In this driver this is the same as netd_init()
+ */
+void netd_reset(uint8_t rhport) {
+  (void) rhport;
+
+  netd_init();
+} // netd_reset
+
+/**
+ * Open the USB interface.
+ * - parse the USB descriptor \a TUD_CDC_NCM_DESCRIPTOR for itfnum and endpoints
+ * - a specific order of elements in the descriptor is tested.
+ *
+ * \note
+ *   Actually all of the information could be read directly from \a itf_desc, because the
+ *   structure and the values are well known.  But we do it this way.
+ *
+ * \post
+ * - \a itf_num set
+ * - \a ep_notif, \a ep_in and \a ep_out are set
+ * - USB interface is open
+ */
+uint16_t netd_open(uint8_t rhport, tusb_desc_interface_t const *itf_desc, uint16_t max_len) {
+  TU_ASSERT(ncm_interface.ep_notif == 0, 0);// assure that the interface is only opened once
+
+  ncm_interface.itf_num = itf_desc->bInterfaceNumber;// management interface
+
+  // skip the two first entries and the following TUSB_DESC_CS_INTERFACE entries
+  uint16_t drv_len = sizeof(tusb_desc_interface_t);
+  uint8_t const *p_desc = tu_desc_next(itf_desc);
+  while (tu_desc_type(p_desc) == TUSB_DESC_CS_INTERFACE && drv_len <= max_len) {
+    drv_len += tu_desc_len(p_desc);
+    p_desc = tu_desc_next(p_desc);
+  }
+
+  // get notification endpoint
+  TU_ASSERT(tu_desc_type(p_desc) == TUSB_DESC_ENDPOINT, 0);
+  TU_ASSERT(usbd_edpt_open(rhport, (tusb_desc_endpoint_t const *) p_desc), 0);
+  ncm_interface.ep_notif = ((tusb_desc_endpoint_t const *) p_desc)->bEndpointAddress;
+  drv_len += tu_desc_len(p_desc);
+  p_desc = tu_desc_next(p_desc);
+
+  // skip the following TUSB_DESC_INTERFACE entries (which must be TUSB_CLASS_CDC_DATA)
+  while (tu_desc_type(p_desc) == TUSB_DESC_INTERFACE && drv_len <= max_len) {
+    tusb_desc_interface_t const *data_itf_desc = (tusb_desc_interface_t const *) p_desc;
+    TU_ASSERT(data_itf_desc->bInterfaceClass == TUSB_CLASS_CDC_DATA, 0);
+
+    drv_len += tu_desc_len(p_desc);
+    p_desc = tu_desc_next(p_desc);
+  }
+
+  // a TUSB_DESC_ENDPOINT (actually two) must follow, open these endpoints
+  TU_ASSERT(tu_desc_type(p_desc) == TUSB_DESC_ENDPOINT, 0);
+  TU_ASSERT(usbd_open_edpt_pair(rhport, p_desc, 2, TUSB_XFER_BULK, &ncm_interface.ep_out, &ncm_interface.ep_in));
+  drv_len += 2 * sizeof(tusb_desc_endpoint_t);
+
+  return drv_len;
+} // netd_open
+
+/**
+ * Handle TinyUSB requests to process transfer events.
+ */
+bool netd_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes) {
+  (void) result;
+
+  if (ep_addr == ncm_interface.ep_out) {
+    // new NTB received
+    // - make the NTB valid
+    // - if ready transfer datagrams to the glue logic for further processing
+    // - if there is a free receive buffer, initiate reception
+    if (!recv_validate_datagram(ncm_interface.recv_tinyusb_ntb, xferred_bytes)) {
+      // verification failed: ignore NTB and return it to free
+      TU_LOG_DRV("Invalid datatagram. Ignoring NTB\n");
+      recv_put_ntb_into_free_list(ncm_interface.recv_tinyusb_ntb);
+    } else {
+      // packet ok -> put it into ready list
+      recv_put_ntb_into_ready_list(ncm_interface.recv_tinyusb_ntb);
+    }
+    ncm_interface.recv_tinyusb_ntb = NULL;
+    tud_network_recv_renew_r(rhport);
+  } else if (ep_addr == ncm_interface.ep_in) {
+    // transmission of an NTB finished
+    // - free the transmitted NTB buffer
+    // - insert ZLPs when necessary
+    // - if there is another transmit NTB waiting, try to start transmission
+#if CFG_TUD_NCM_XMIT_SG
+    xmit_sg_release(ncm_interface.xmit_tinyusb_ntb);
+#endif
+    xmit_put_ntb_into_free_list(ncm_interface.xmit_tinyusb_ntb);
+    ncm_interface.xmit_tinyusb_ntb = NULL;
+    if (!xmit_insert_required_zlp(rhport, xferred_bytes)) {
+      xmit_start_if_possible(rhport);
+    }
+    tud_network_xmit_done_cb();
+  } else if (ep_addr == ncm_interface.ep_notif) {
+    // next transfer on notification channel
+    notification_xmit(rhport, true);
+  }
+
+  NTB_LISTS_CHECK();
+  return true;
+} // netd_xfer_cb
+
+/**
+ * Respond to TinyUSB control requests.
+ * At startup transmission of notification packets are done here.
+ */
+bool netd_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request) {
+  if (stage == CONTROL_STAGE_DATA && request->bmRequestType_bit.type == TUSB_REQ_TYPE_CLASS &&
+      request->bRequest == NCM_SET_NTB_INPUT_SIZE) {
+    // returning false stalls the status stage
+    return ntb_input_size_set(request->wLength);
+  }
+#if CFG_TUD_NET_MC_FILTER_N
+  if (stage == CONTROL_STAGE_DATA && request->bmRequestType_bit.type == TUSB_REQ_TYPE_CLASS &&
+      request->bRequest == CDC_REQUEST_SET_ETHERNET_MULTICAST_FILTERS) {
+    netd_filter_mc_set(&ncm_interface.filter, ncm_interface.mc_filters, request->wValue);
+    return true;
+  }
+#endif
+  if (stage != CONTROL_STAGE_SETUP) {
+    return true;
+  }
+
+  switch (request->bmRequestType_bit.type) {
+    case TUSB_REQ_TYPE_STANDARD:
+
+      switch (request->bRequest) {
+        case TUSB_REQ_GET_INTERFACE: {
+          TU_VERIFY(ncm_interface.itf_num + 1 == request->wIndex, false);
+
+          tud_control_xfer(rhport, request, &ncm_interface.itf_data_alt, 1);
+        } break;
+
+        case TUSB_REQ_SET_INTERFACE: {
+          TU_VERIFY(ncm_interface.itf_num + 1 == request->wIndex && request->wValue < 2, false);
+
+          ncm_interface.itf_data_alt = (uint8_t) request->wValue;
+
+          if (ncm_interface.itf_data_alt == 0) {
+            // spec 7.2: selecting alternate setting 0 resets the NTB format, input size and CRC mode
+            ncm_interface.ntb_format = NCM_NTB_FORMAT_16;
+            ncm_interface.crc_mode = NCM_CRC_MODE_NONE;
+            ntb_input_size_reset();
+          } else {
+            tud_network_init_cb();
+            tud_network_recv_renew_r(rhport);
+            ncm_interface.notification_xmit_state = NOTIFICATION_SPEED;
+            notification_xmit(rhport, false);
+          }
+          tud_control_status(rhport, request);
+        } break;
+
+        // unsupported request
+        default:
+          return false;
+      }
+      break;
+
+    case TUSB_REQ_TYPE_CLASS:
+      TU_VERIFY(ncm_interface.itf_num == request->wIndex, false);
+      switch (request->bRequest) {
+        case NCM_GET_NTB_PARAMETERS: {
+          // transfer NTB parameters to host.
+          tud_control_xfer(rhport, request, (void *) (uintptr_t) &ntb_parameters, sizeof(ntb_parameters));
+        } break;
+
+        case NCM_GET_NTB_FORMAT: {
+          tud_control_xfer(rhport, request, &ncm_interface.ntb_format, sizeof(ncm_interface.ntb_format));
+        } break;
+
+        case NCM_SET_NTB_FORMAT: {
+          // only while the data interface is inactive, there must not be NTBs in flight
+          TU_VERIFY(ncm_interface.itf_data_alt == 0, false);
+          TU_VERIFY(request->wValue == NCM_NTB_FORMAT_16 || request->wValue == NCM_NTB_FORMAT_32, false);
+          ncm_interface.ntb_format = request->wValue;
+          if (ncm_interface.ntb_in_size < (uint32_t) xmit_header_len() + CFG_TUD_NET_MTU + xmit_crc_len()) {
+            // NTB32 headers leave no room for a full size datagram
+            ncm_interface.ntb_format = NCM_NTB_FORMAT_16;
+            return false;
+          }
+          tud_control_status(rhport, request);
+        } break;
+
+        case NCM_GET_CRC_MODE: {
+          tud_control_xfer(rhport, request, &ncm_interface.crc_mode, sizeof(ncm_interface.crc_mode));
+        } break;
+
+        case NCM_SET_CRC_MODE: {
+          // only while the data interface is inactive, like SET_NTB_FORMAT
+          TU_VERIFY(ncm_interface.itf_data_alt == 0, false);
+          TU_VERIFY(request->wValue == NCM_CRC_MODE_NONE || (CFG_TUD_NCM_CRC && request->wValue == NCM_CRC_MODE_APPENDED), false);
+          TU_VERIFY(request->wValue == NCM_CRC_MODE_NONE ||
+                    ncm_interface.ntb_in_size >= (uint32_t) xmit_header_len() + CFG_TUD_NET_MTU + NCM_CRC_LEN, false);
+          ncm_interface.crc_mode = request->wValue;
+          tud_control_status(rhport, request);
+        } break;
+
+        case CDC_REQUEST_SET_ETHERNET_PACKET_FILTER: {
+          ncm_interface.filter.packet = request->wValue;
+          ncm_interface.filter.set = true;
+          tud_control_status(rhport, request);
+        } break;
+
+#if CFG_TUD_NET_MC_FILTER_N
+        case CDC_REQUEST_SET_ETHERNET_MULTICAST_FILTERS: {
+          // wValue addresses of 6 bytes, applied in the data stage
+          TU_VERIFY(request->wValue <= CFG_TUD_NET_MC_FILTER_N && request->wLength == 6 * request->wValue, false);
+          if (request->wLength == 0) {
+            netd_filter_mc_set(&ncm_interface.filter, NULL, 0);
+            tud_control_status(rhport, request);
+          } else {
+            tud_control_xfer(rhport, request, ncm_interface.mc_filters, request->wLength);
+          }
+        } break;
+#endif
+
+        case NCM_GET_NTB_INPUT_SIZE: {
+          ncm_interface.ntb_input_size.dwNtbInMaxSize = ncm_interface.ntb_in_size;
+          ncm_interface.ntb_input_size.wNtbInMaxDatagrams = ncm_interface.ntb_in_max_datagrams;
+          ncm_interface.ntb_input_size.wReserved = 0;
+          tud_control_xfer(rhport, request, &ncm_interface.ntb_input_size, sizeof(ncm_interface.ntb_input_size));
+        } break;
+
+        case NCM_SET_NTB_INPUT_SIZE: {
+          // 4 bytes, or 8 bytes with wNtbInMaxDatagrams; the values are applied in the data stage
+          TU_VERIFY(request->wLength == sizeof(uint32_t) || request->wLength == sizeof(ntb_input_size_t), false);
+          memset(&ncm_interface.ntb_input_size, 0, sizeof(ncm_interface.ntb_input_size));
+          tud_control_xfer(rhport, request, &ncm_interface.ntb_input_size, request->wLength);
+        } break;
+
+          // unsupported request
+        default:
+          return false;
+      }
+      break;
+      // unsupported request
+    default:
+      return false;
+  }
+
+  return true;
+} // netd_control_xfer_cb
+
+#endif // ( CFG_TUD_ENABLED && CFG_TUD_NCM )
@@ -0,0 +1,303 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2020 Peter Lawrence
+ * Copyright (c) 2019 Ha Thach (tinyusb.org)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * This file is part of the TinyUSB stack.
+ */
+
+#ifndef _TUSB_NET_DEVICE_H_
+#define _TUSB_NET_DEVICE_H_
+
+#include <stdint.h>
+#include "class/cdc/cdc.h"
+
+#if CFG_TUD_ECM_RNDIS && CFG_TUD_NCM
+#error "Cannot enable both ECM_RNDIS and NCM network drivers"
+#endif
+
+/* declared here, NOT in usb_descriptors.c, so that the driver can intelligently ZLP as needed */
+#define CFG_TUD_NET_ENDPOINT_SIZE (TUD_OPT_HIGH_SPEED ? 512 : 64)
+
+/* Maximum Transmission Unit (in bytes) of the network, including Ethernet header */
+#ifndef CFG_TUD_NET_MTU
+#define CFG_TUD_NET_MTU           1514
+#endif
+
+/* ECM/RNDIS: number of OUT (reception) and IN (transmission) packet buffers. With more than one,
+   the next OUT transfer is queued while the application still holds the previous frame, and a frame
+   can be staged while the one before it is on the wire */
+#ifndef CFG_TUD_ECM_RNDIS_OUT_BUF_N
+#define CFG_TUD_ECM_RNDIS_OUT_BUF_N 1
+#endif
+
+#ifndef CFG_TUD_ECM_RNDIS_IN_BUF_N
+#define CFG_TUD_ECM_RNDIS_IN_BUF_N  1
+#endif
+
+/* RNDIS: REMOTE_NDIS_PACKET_MSGs per bulk transfer (MaxPacketsPerTransfer) in both directions.
+   The packet buffers above are sized for that many MTU sized messages */
+#ifndef CFG_TUD_RNDIS_MAX_PACKETS_PER_XFER
+#define CFG_TUD_RNDIS_MAX_PACKETS_PER_XFER 1
+#endif
+
+/* multicast addresses the host may select with SetEthernetMulticastFilters (ECM, NCM) or
+   OID_802_3_MULTICAST_LIST (RNDIS).  They are hashed into a 64 bit table, the filtering is imperfect.
+   0: no list, the packet filter passes all multicast or none */
+#ifndef CFG_TUD_NET_MC_FILTER_N
+#define CFG_TUD_NET_MC_FILTER_N 0
+#endif
+
+// wNumberMCFilters of the Ethernet Networking Functional Descriptor, D15 set for imperfect filtering
+#define TUD_NET_MC_FILTERS_DESC   (CFG_TUD_NET_MC_FILTER_N ? (0x8000 | CFG_TUD_NET_MC_FILTER_N) : 0)
+
+
+// Table 4.3 Data Class Interface Protocol Codes
+typedef enum
+{
+  NCM_DATA_PROTOCOL_NETWORK_TRANSFER_BLOCK = 0x01
+} ncm_data_interface_protocol_code_t;
+
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Application API
+//--------------------------------------------------------------------+
+
+// indicate to network driver that client has finished with the packet provided to network_recv_cb()
+void tud_network_recv_renew(void);
+
+// poll network driver for its ability to accept another packet to transmit
+bool tud_network_can_xmit(uint16_t size);
+
+// if network_can_xmit() returns true, network_xmit() can be called once
+void tud_network_xmit(void *ref, uint16_t arg);
+
+// set the upstream link state reported to the host by the NetworkConnection and ConnectionSpeedChange
+// notifications (NCM, ECM), speeds in bit/s, 0 reports the driver default.  Both are sent again on every
+// change; call from the TinyUSB task.  Default is connected.
+void tud_network_link_state(bool connected, uint32_t downlink, uint32_t uplink);
+
+// whether the packet filter and multicast filters selected by the host pass a frame to destination
+// address \a dst; everything passes until the host sets a packet filter.  For the glue logic to drop
+// unwanted frames before queuing them, the ECM/RNDIS driver also drops them in tud_network_xmit().
+// May be called from any task, a filter change is picked up with the next frame.
+bool tud_network_filter_accepts(const uint8_t *dst);
+
+//--------------------------------------------------------------------+
+// Application Callbacks (WEAK is optional)
+//--------------------------------------------------------------------+
+
+// client must provide this: return false if the packet buffer was not accepted
+bool tud_network_recv_cb(const uint8_t *src, uint16_t size);
+
+// client must provide this: copy from network stack packet pointer to dst
+uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg);
+
+// optional: invoked (in TinyUSB task context) when a transmit buffer has been released,
+// i.e. tud_network_can_xmit() may have turned true again
+void tud_network_xmit_done_cb(void);
+
+// client must provide this: initialize any network state back to the beginning
+// (ECM/RNDIS: host enabled the interface, NCM: host selected the active data alternate setting)
+void tud_network_init_cb(void);
+
+//------------- ECM/RNDIS -------------//
+
+// client must provide this: 48-bit MAC address
+// TODO removed later since it is not part of tinyusb stack
+extern uint8_t tud_network_mac_address[6];
+
+#if CFG_TUD_ECM_RNDIS
+// traffic counters of one direction, cumulative since power-up.  Multicast and broadcast are part of
+// frames/bytes, directed is the rest
+typedef struct {
+  uint32_t frames;              // xmit: queued to the host, recv: accepted by the application
+  uint32_t bytes;               // Ethernet frame bytes of those
+  uint32_t multicast_frames;
+  uint32_t multicast_bytes;
+  uint32_t broadcast_frames;
+  uint32_t broadcast_bytes;
+  uint32_t errors;              // recv: malformed RNDIS data messages (rest of the transfer dropped), xmit: 0
+  uint32_t drop_filter;         // xmit: not selected by the host's packet filter
+  uint32_t drop_no_buffer;      // xmit: tud_network_xmit() without a free buffer, recv: refused by tud_network_recv_cb()
+} tud_network_dir_stats_t;
+
+typedef struct {
+  tud_network_dir_stats_t xmit; // device -> host
+  tud_network_dir_stats_t recv; // host -> device
+} tud_ecm_rndis_stats_t;
+
+// copy the traffic counters
+void tud_network_ecm_rndis_stats(tud_ecm_rndis_stats_t *stats);
+#endif
+
+//------------- NCM -------------//
+
+#if CFG_TUD_NCM
+// NTB sizes and datagram counts, limited by CFG_TUD_NCM_{IN,OUT}_NTB_MAX_SIZE and
+// CFG_TUD_NCM_IN_MAX_DATAGRAMS_PER_NTB (which size the static buffers)
+typedef struct {
+  uint32_t ntb_in_max_size;     // device -> host NTB size (dwNtbInMaxSize)
+  uint32_t ntb_out_max_size;    // host -> device NTB size (dwNtbOutMaxSize)
+  uint16_t in_max_datagrams;    // datagrams the device aggregates into one IN NTB
+  uint16_t out_max_datagrams;   // datagrams the host may put into one OUT NTB (wNtbOutMaxDatagrams),
+                                // 1..CFG_TUD_NCM_OUT_DATAGRAM_TABLE_N
+} tud_ncm_config_t;
+
+// a datagram of a received NTB, see tud_network_recv_batch_cb()
+typedef struct {
+  const uint8_t *data;
+  uint16_t length;
+} tud_network_datagram_t;
+
+// receive side counters, cumulative since power-up
+typedef struct {
+  uint32_t ntbs;                // NTBs accepted
+  uint32_t datagrams;           // datagrams in accepted NTBs
+  uint32_t drop_nth;            // NTBs dropped: bad NTH (signature, header or block length, wrong NTB format)
+  uint32_t drop_ndp;            // NTBs dropped: bad NDP (position, signature, length, no terminator)
+  uint32_t drop_ndp_chain;      // NTBs dropped: more than CFG_TUD_NCM_OUT_MAX_NDPS_PER_NTB chained NDPs
+  uint32_t drop_datagram;       // NTBs dropped: datagram pointer outside the block
+  uint32_t drop_table_full;     // NTBs dropped: more than CFG_TUD_NCM_OUT_DATAGRAM_TABLE_N datagrams
+  uint32_t drop_crc;            // datagrams dropped: bad CRC-32 in an NCM1 NDP (the rest of the NTB is kept)
+} tud_ncm_recv_stats_t;
+
+// select NTB sizes and datagram counts, only possible while the data interface is inactive
+bool tud_network_ncm_config(tud_ncm_config_t const *cfg);
+
+// optional: invoked by tud_network_xmit() after a datagram was appended to the current NTB.
+// Return true to keep the NTB back for more datagrams instead of starting the transfer on an
+// idle endpoint; the application then has to call tud_network_ncm_xmit_flush() (TinyUSB task
+// context) within its hold-off time.  A full NTB or a completed transfer sends it regardless.
+bool tud_network_ncm_xmit_holdoff_cb(uint16_t datagrams, uint16_t ntb_len);
+
+// start transmission of an NTB kept back by tud_network_ncm_xmit_holdoff_cb()
+void tud_network_ncm_xmit_flush(void);
+
+// optional: invoked with the datagrams of a received NTB that were not consumed yet (all of them at first),
+// instead of one tud_network_recv_cb() per datagram.  Return how many were consumed, counted from the
+// first one; they stay valid until tud_network_recv_renew(), which releases them at once and offers the
+// rest or the next NTB.  0 refuses the first datagram, it is offered again on the next renew.
+// The default implementation passes the first datagram to tud_network_recv_cb().
+uint16_t tud_network_recv_batch_cb(const tud_network_datagram_t *datagrams, uint16_t count);
+
+// copy the receive counters
+void tud_network_ncm_recv_stats(tud_ncm_recv_stats_t *stats);
+
+// optional: CRC-32 of IEEE 802.3 for the CRC mode, zlib convention (0 to start, result is final and
+// can be chained).  Checks received NCM1 datagrams and, after SET_CRC_MODE, appends the CRC to the
+// transmitted ones.  The default implementation works bit by bit, provide a table driven one.
+uint32_t tud_network_ncm_crc32_cb(uint32_t crc, const uint8_t *data, uint16_t len);
+
+// client must provide this with CFG_TUD_NCM_XMIT_SG: describe the datagram passed to tud_network_xmit()
+// as up to \a max segments in transmission order instead of copying it.  Return the number of segments,
+// the memory must stay valid until tud_network_xmit_sg_release_cb().  0 if it does not fit: the
+// datagram is then copied with tud_network_xmit_cb() as usual.
+uint8_t tud_network_xmit_sg_cb(void *ref, uint16_t arg, tud_network_datagram_t *segs, uint8_t max);
+
+// client must provide this with CFG_TUD_NCM_XMIT_SG: a datagram described by tud_network_xmit_sg_cb()
+// has been sent (or dropped by a bus reset) and may be freed
+void tud_network_xmit_sg_release_cb(void *ref);
+#endif
+
+//--------------------------------------------------------------------+
+// INTERNAL USBD-CLASS DRIVER API
+//--------------------------------------------------------------------+
+void     netd_init            (void);
+bool     netd_deinit          (void);
+void     netd_reset           (uint8_t rhport);
+uint16_t netd_open            (uint8_t rhport, tusb_desc_interface_t const * itf_desc, uint16_t max_len);
+bool     netd_control_xfer_cb (uint8_t rhport, uint8_t stage, tusb_control_request_t const * request);
+bool     netd_xfer_cb         (uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes);
+void     netd_report          (uint8_t *buf, uint16_t len);
+
+// RNDIS initialized: host_max_transfer is the largest transfer the host accepts, returns the
+// largest one the device accepts (MaxTransferSize of REMOTE_NDIS_INITIALIZE_CMPLT)
+uint32_t netd_rndis_initialize(uint32_t host_max_transfer);
+
+// packet filter selected by the host (NDIS_PACKET_TYPE_* bits), applied to frames sent to the host
+void     netd_packet_filter   (uint32_t ndis_filter);
+
+// RNDIS reset or halt: drop the packet filter and multicast filters
+void     netd_packet_filter_reset(void);
+
+// RNDIS OID_802_3_MULTICAST_LIST, false if the list has more than CFG_TUD_NET_MC_FILTER_N addresses
+bool     netd_multicast_list  (uint8_t const *addrs, uint16_t count);
+
+// host selected frame filter of the ECM/RNDIS and NCM drivers
+typedef struct {
+  bool     set;                 // host has set a packet filter, everything passes before
+  uint16_t packet;              // cdc_ethernet_packet_filter_t bits
+  uint32_t mc_hash[2];          // 64 bit table of the hashed multicast filters
+} netd_filter_t;
+
+// bucket of a multicast address in netd_filter_t::mc_hash (FNV-1a, top 6 bits)
+TU_ATTR_ALWAYS_INLINE static inline uint8_t netd_filter_mc_hash(uint8_t const *addr) {
+  uint32_t h = 2166136261u;
+  for (uint8_t i = 0; i < 6; i++) {
+    h = (h ^ addr[i]) * 16777619u;
+  }
+  return (uint8_t) (h >> 26);
+}
+
+// replace the multicast filters with \a count addresses of 6 bytes
+TU_ATTR_ALWAYS_INLINE static inline void netd_filter_mc_set(netd_filter_t *f, uint8_t const *addrs, uint16_t count) {
+  uint32_t hash[2] = { 0, 0 };
+  for (uint16_t i = 0; i < count; i++) {
+    uint8_t const b = netd_filter_mc_hash(addrs + 6 * i);
+    hash[b >> 5] |= TU_BIT(b & 31);
+  }
+  f->mc_hash[0] = hash[0];
+  f->mc_hash[1] = hash[1];
+}
+
+TU_ATTR_ALWAYS_INLINE static inline bool netd_filter_accepts(netd_filter_t const *f, uint8_t const *dst) {
+  uint16_t const packet = f->packet;
+  if (!f->set || (packet & CDC_ETHERNET_PACKET_TYPE_PROMISCUOUS)) {
+    return true;
+  }
+  if (!(dst[0] & 0x01)) {
+    return (packet & CDC_ETHERNET_PACKET_TYPE_DIRECTED) != 0;
+  }
+  if ((dst[0] & dst[1] & dst[2] & dst[3] & dst[4] & dst[5]) == 0xff) {
+    return (packet & CDC_ETHERNET_PACKET_TYPE_BROADCAST) != 0;
+  }
+  if (packet & CDC_ETHERNET_PACKET_TYPE_ALL_MULTICAST) {
+    return true;
+  }
+  if (!(packet & CDC_ETHERNET_PACKET_TYPE_MULTICAST)) {
+    return false;
+  }
+  // without a list the multicast filter can not select anything, pass all multicast
+  uint8_t const b = netd_filter_mc_hash(dst);
+  return CFG_TUD_NET_MC_FILTER_N == 0 || (f->mc_hash[b >> 5] & TU_BIT(b & 31)) != 0;
+}
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _TUSB_NET_DEVICE_H_ */
@@ -62,6 +62,12 @@ typedef struct {
 
 }tu_edpt_stream_t;
 
+// One contiguous piece of a gathered (scatter-gather) transfer
+typedef struct {
+  uint8_t const* buffer;
+  uint16_t len;
+}tu_edpt_seg_t;
+
 //--------------------------------------------------------------------+
 // Endpoint
 //--------------------------------------------------------------------+
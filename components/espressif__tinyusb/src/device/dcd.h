@@ -30,6 +30,7 @@
 #include "common/tusb_common.h"
 #include "osal/osal.h"
 #include "common/tusb_fifo.h"
+#include "common/tusb_private.h"
 
 #ifdef __cplusplus
  extern "C" {
@@ -164,6 +165,12 @@ bool dcd_edpt_xfer            (uint8_t rhport, uint8_t ep_addr, uint8_t * buffer
 // This API is optional, may be useful for register-based for transferring data.
 bool dcd_edpt_xfer_fifo       (uint8_t rhport, uint8_t ep_addr, tu_fifo_t * ff, uint16_t total_bytes) TU_ATTR_WEAK;
 
+// Submit an IN transfer gathered from seg_count segments sent back to back as one transfer,
+// When complete dcd_event_xfer_complete() is invoked to notify the stack.
+// The segment list must stay valid until the transfer completes.
+// This API is optional, return false if it is not supported in the current mode (e.g. DMA).
+bool dcd_edpt_xfer_sg         (uint8_t rhport, uint8_t ep_addr, tu_edpt_seg_t const * segs, uint8_t seg_count, uint16_t total_bytes) TU_ATTR_WEAK;
+
 // Stall endpoint, any queuing transfer should be removed from endpoint
 void dcd_edpt_stall           (uint8_t rhport, uint8_t ep_addr);
 
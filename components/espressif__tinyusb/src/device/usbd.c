@@ -1392,6 +1392,37 @@ bool usbd_edpt_xfer_fifo(uint8_t rhport, uint8_t ep_addr, tu_fifo_t* ff, uint16_
   }
 }
 
+bool usbd_edpt_xfer_sg(uint8_t rhport, uint8_t ep_addr, tu_edpt_seg_t const* segs, uint8_t seg_count, uint16_t total_bytes) {
+  rhport = _usbd_rhport;
+
+  uint8_t const epnum = tu_edpt_number(ep_addr);
+  uint8_t const dir = tu_edpt_dir(ep_addr);
+
+  // optional DCD API
+  if (dcd_edpt_xfer_sg == NULL) {
+    return false;
+  }
+
+  TU_LOG_USBD("  Queue EP %02X with %u bytes in %u segments ... ", ep_addr, total_bytes, seg_count);
+
+  // Attempt to transfer on a busy endpoint, sound like an race condition !
+  TU_ASSERT(_usbd_dev.ep_status[epnum][dir].busy == 0);
+
+  // Set busy first since the actual transfer can be complete before dcd_edpt_xfer_sg() could return
+  // and usbd task can preempt and clear the busy
+  _usbd_dev.ep_status[epnum][dir].busy = 1;
+
+  if (dcd_edpt_xfer_sg(rhport, ep_addr, segs, seg_count, total_bytes)) {
+    TU_LOG_USBD("OK\r\n");
+    return true;
+  } else {
+    // DCD can not gather in its current mode, leave the endpoint ready for the caller's fallback transfer
+    _usbd_dev.ep_status[epnum][dir].busy = 0;
+    TU_LOG_USBD("unsupported\r\n");
+    return false;
+  }
+}
+
 bool usbd_edpt_busy(uint8_t rhport, uint8_t ep_addr) {
   (void) rhport;
 
@@ -86,6 +86,10 @@ bool usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t * buffer, uint16_t
 // Submit a usb ISO transfer by use of a FIFO (ring buffer) - all bytes in FIFO get transmitted
 bool usbd_edpt_xfer_fifo(uint8_t rhport, uint8_t ep_addr, tu_fifo_t * ff, uint16_t total_bytes);
 
+// Submit a usb IN transfer gathered from a list of segments, see dcd_edpt_xfer_sg().
+// Return false without side effects if the DCD can not gather, caller should fall back to usbd_edpt_xfer()
+bool usbd_edpt_xfer_sg(uint8_t rhport, uint8_t ep_addr, tu_edpt_seg_t const * segs, uint8_t seg_count, uint16_t total_bytes);
+
 // Claim an endpoint before submitting a transfer.
 // If caller does not make any transfer, it must release endpoint for others.
 bool usbd_edpt_claim(uint8_t rhport, uint8_t ep_addr);
@@ -54,6 +54,8 @@
 typedef struct {
   uint8_t* buffer;
   tu_fifo_t* ff;
+  tu_edpt_seg_t const* sg; // gathered IN transfer: current segment and offset into it
+  uint16_t sg_offset;
   uint16_t total_len;
   uint16_t max_size;
   uint8_t interval;
@@ -594,6 +596,7 @@ bool dcd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t* buffer, uint16_t to
   }
   xfer->buffer = buffer;
   xfer->ff = NULL;
+  xfer->sg = NULL;
   xfer->total_len = total_bytes;
 
   // EP0 can only handle one packet
@@ -627,6 +630,7 @@ bool dcd_edpt_xfer_fifo(uint8_t rhport, uint8_t ep_addr, tu_fifo_t* ff, uint16_t
   }
   xfer->buffer = NULL;
   xfer->ff = ff;
+  xfer->sg = NULL;
   xfer->total_len = total_bytes;
 
   // Schedule packets to be sent within interrupt
@@ -637,6 +641,39 @@ bool dcd_edpt_xfer_fifo(uint8_t rhport, uint8_t ep_addr, tu_fifo_t* ff, uint16_t
   return true;
 }
 
+#if CFG_TUD_DWC2_SLAVE_ENABLE
+// Gathered IN transfer: packets are assembled from the segments while writing the TX FIFO.
+// Buffer DMA needs one contiguous buffer per transfer, therefore only supported in slave mode.
+bool dcd_edpt_xfer_sg(uint8_t rhport, uint8_t ep_addr, tu_edpt_seg_t const* segs, uint8_t seg_count, uint16_t total_bytes) {
+  dwc2_regs_t* dwc2 = DWC2_REG(rhport);
+  uint8_t const epnum = tu_edpt_number(ep_addr);
+  uint8_t const dir = tu_edpt_dir(ep_addr);
+  (void) seg_count;
+
+  if (dma_device_enabled(dwc2) || epnum == 0 || dir != TUSB_DIR_IN) {
+    return false;
+  }
+
+  DCD_ENTER_CRITICAL();
+  xfer_ctl_t* xfer = XFER_CTL_BASE(epnum, dir);
+  if (xfer->max_size == 0) {
+    DCD_EXIT_CRITICAL();
+    return false; // Endpoint is closed
+  }
+  xfer->buffer = NULL;
+  xfer->ff = NULL;
+  xfer->sg = segs;
+  xfer->sg_offset = 0;
+  xfer->total_len = total_bytes;
+
+  // Schedule packets to be sent within interrupt
+  edpt_schedule_packets(rhport, epnum, dir);
+  DCD_EXIT_CRITICAL();
+
+  return true;
+}
+#endif
+
 void dcd_edpt_stall(uint8_t rhport, uint8_t ep_addr) {
   dwc2_regs_t* dwc2 = DWC2_REG(rhport);
   edpt_disable(rhport, ep_addr, true);
@@ -845,6 +882,54 @@ static void handle_epout_slave(uint8_t rhport, uint8_t epnum, dwc2_doepint_t doe
   }
 }
 
+// Write a single packet of a gathered transfer to the TX FIFO, packets may span several segments
+static void dfifo_write_packet_sg(dwc2_regs_t* dwc2, uint8_t fifo_num, xfer_ctl_t* xfer, uint16_t len) {
+  volatile uint32_t* tx_fifo = dwc2->fifo[fifo_num];
+  uint32_t tmp_word = 0;
+  uint8_t tmp_count = 0;
+
+  while (len) {
+    const tu_edpt_seg_t* seg = xfer->sg;
+    const uint8_t* src = seg->buffer + xfer->sg_offset;
+    uint16_t n = tu_min16(len, (uint16_t) (seg->len - xfer->sg_offset));
+
+    len -= n;
+    xfer->sg_offset += n;
+    if (xfer->sg_offset == seg->len) {
+      xfer->sg++;
+      xfer->sg_offset = 0;
+    }
+
+    // complete a word started by the previous segment
+    while (n && tmp_count) {
+      tmp_word |= (uint32_t) (*src++) << (8 * tmp_count);
+      n--;
+      if (++tmp_count == 4) {
+        *tx_fifo = tmp_word;
+        tmp_word = 0;
+        tmp_count = 0;
+      }
+    }
+
+    // Pushing full available 32 bit words to fifo
+    while (n >= 4) {
+      *tx_fifo = tu_unaligned_read32(src);
+      src += 4;
+      n -= 4;
+    }
+
+    // keep the remaining 1-3 bytes for the next segment
+    while (n--) {
+      tmp_word |= (uint32_t) (*src++) << (8 * tmp_count);
+      tmp_count++;
+    }
+  }
+
+  if (tmp_count) {
+    *tx_fifo = tmp_word;
+  }
+}
+
 static void handle_epin_slave(uint8_t rhport, uint8_t epnum, dwc2_diepint_t diepint_bm) {
   dwc2_regs_t* dwc2 = DWC2_REG(rhport);
   dwc2_dep_t* epin = &dwc2->epin[epnum];
@@ -879,6 +964,8 @@ static void handle_epin_slave(uint8_t rhport, uint8_t epnum, dwc2_diepint_t diep
       if (xfer->ff) {
         volatile uint32_t* tx_fifo = dwc2->fifo[epnum];
         tu_fifo_read_n_const_addr_full_words(xfer->ff, (void*)(uintptr_t)tx_fifo, xact_bytes);
+      } else if (xfer->sg) {
+        dfifo_write_packet_sg(dwc2, epnum, xfer, xact_bytes);
       } else {
         dfifo_write_packet(dwc2, epnum, xfer->buffer, xact_bytes);
         xfer->buffer += xact_bytes;
@@ -539,6 +539,11 @@
   #define CFG_TUD_NCM         0
 #endif
 
+// NCM: accept the CRC mode (SET_CRC_MODE), announced in the NCM functional descriptor
+#ifndef CFG_TUD_NCM_CRC
+  #define CFG_TUD_NCM_CRC     0
+#endif
+
 //--------------------------------------------------------------------
 // Host Options (Default)
 //--------------------------------------------------------------------
@@ -0,0 +1,6 @@
+/* ethernet.h
+ * The part of lwIP's netif/ethernet.h that rndis_reports.c uses, for the host build.
+ */
+#pragma once
+
+#define SIZEOF_ETH_HDR 14
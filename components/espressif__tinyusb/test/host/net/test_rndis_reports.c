@@ -0,0 +1,153 @@
+/* test_rndis_reports.c
+ * Host unit tests for the RNDIS control messages of rndis_reports.c: the multicast list a
+ * host sets is validated against the message it arrived in and answered back on query.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "tusb.h"
+#include "rndis_protocol.h"
+
+static int s_failures;
+
+#define CHECK(cond, ...) do {                                   \
+        if (!(cond)) {                                          \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);         \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            s_failures++;                                       \
+        }                                                       \
+    } while (0)
+
+void rndis_class_set_handler(uint8_t *data, int size);
+
+/* ---------------- class driver stubs ---------------- */
+uint8_t tud_network_mac_address[6];
+
+void netd_report(uint8_t *buf, uint16_t len) { (void)buf; (void)len; }
+void netd_packet_filter(uint32_t ndis_filter) { (void)ndis_filter; }
+void netd_packet_filter_reset(void) {}
+uint32_t netd_rndis_initialize(uint32_t host_max_transfer) { return host_max_transfer; }
+void tud_network_ecm_rndis_stats(tud_ecm_rndis_stats_t *stats) { memset(stats, 0, sizeof(*stats)); }
+
+static int s_lists;
+static uint16_t s_list_n;
+bool netd_multicast_list(uint8_t const *addrs, uint16_t n)
+{
+    (void)addrs;
+    if (n > CFG_TUD_NET_MC_FILTER_N) return false;
+    s_lists++;
+    s_list_n = n;
+    return true;
+}
+
+/* ---------------- helpers ---------------- */
+/* the class driver's control buffer, with guard bytes behind it that must never be echoed */
+static struct {
+    uint8_t ctrl[RNDIS_CONTROL_SIZE];
+    uint8_t guard[64];
+} s_buf __attribute__((aligned(4)));
+
+/* SET OID_802_3_MULTICAST_LIST with n addresses at info_ofs (relative to RequestId), delivered
+   in a data stage of wlength bytes; returns the completion status */
+static uint32_t set_list(uint32_t n_bytes, uint32_t info_ofs, uint32_t msg_len, int wlength)
+{
+    memset(s_buf.ctrl, 0, sizeof(s_buf.ctrl));
+    rndis_set_msg_t *m = (rndis_set_msg_t *)s_buf.ctrl;
+    m->MessageType = REMOTE_NDIS_SET_MSG;
+    m->MessageLength = msg_len;
+    m->RequestId = 7;
+    m->Oid = OID_802_3_MULTICAST_LIST;
+    m->InformationBufferLength = n_bytes;
+    m->InformationBufferOffset = info_ofs;
+    uint8_t *info = s_buf.ctrl + offsetof(rndis_set_msg_t, RequestId);
+    for (uint32_t i = 0; i < n_bytes && (uint64_t)info_ofs + i < sizeof(s_buf.ctrl) - offsetof(rndis_set_msg_t, RequestId); ++i) {
+        info[info_ofs + i] = (uint8_t)(i + 1);
+    }
+    rndis_class_set_handler(s_buf.ctrl, wlength);
+    return ((rndis_set_cmplt_t *)s_buf.ctrl)->Status;
+}
+
+static uint32_t set_list_ok(uint32_t n)
+{
+    uint32_t len = sizeof(rndis_set_msg_t) + 6 * n;
+    return set_list(6 * n, sizeof(rndis_set_msg_t) - offsetof(rndis_set_msg_t, RequestId), len, (int)len);
+}
+
+static rndis_query_cmplt_t *query_list(void)
+{
+    memset(s_buf.ctrl, 0, sizeof(s_buf.ctrl));
+    rndis_query_msg_t *q = (rndis_query_msg_t *)s_buf.ctrl;
+    q->MessageType = REMOTE_NDIS_QUERY_MSG;
+    q->MessageLength = sizeof(*q);
+    q->RequestId = 8;
+    q->Oid = OID_802_3_MULTICAST_LIST;
+    rndis_class_set_handler(s_buf.ctrl, sizeof(*q));
+    return (rndis_query_cmplt_t *)s_buf.ctrl;
+}
+
+/* ---------------- tests ---------------- */
+static void test_list_round_trip(void)
+{
+    CHECK(set_list_ok(3) == RNDIS_STATUS_SUCCESS && s_list_n == 3, "set 3");
+    rndis_query_cmplt_t *c = query_list();
+    CHECK(c->Status == RNDIS_STATUS_SUCCESS && c->InformationBufferLength == 18, "query %u", c->InformationBufferLength);
+    uint8_t const *b = (uint8_t const *)(c + 1);
+    for (int i = 0; i < 18; ++i) CHECK(b[i] == i + 1, "byte %d", i);
+
+    CHECK(set_list_ok(CFG_TUD_NET_MC_FILTER_N + 1) == RNDIS_STATUS_MULTICAST_FULL, "full");
+    CHECK(query_list()->InformationBufferLength == 18, "full list keeps the old one");
+
+    CHECK(set_list_ok(0) == RNDIS_STATUS_SUCCESS && query_list()->InformationBufferLength == 0, "empty");
+}
+
+static void test_list_rejected(void)
+{
+    uint32_t const rel = offsetof(rndis_set_msg_t, RequestId);
+    uint32_t const hdr = sizeof(rndis_set_msg_t);
+    set_list_ok(1);
+    int lists = s_lists;
+
+    /* not a whole number of addresses */
+    CHECK(set_list(7, hdr - rel, hdr + 7, hdr + 7) == RNDIS_STATUS_INVALID_DATA, "length 7");
+    /* information buffer past the message, past the data stage, past the control buffer */
+    CHECK(set_list(6, hdr - rel + 6, hdr + 6, hdr + 6) == RNDIS_STATUS_INVALID_DATA, "past message");
+    CHECK(set_list(12, hdr - rel, hdr + 12, hdr + 6) == RNDIS_STATUS_INVALID_DATA, "past data stage");
+    CHECK(set_list(6, RNDIS_CONTROL_SIZE - rel, RNDIS_CONTROL_SIZE + 6, 1024) == RNDIS_STATUS_INVALID_DATA,
+          "past control buffer");
+    CHECK(set_list(6, 0xFFFFFFFFu, hdr + 6, hdr + 6) == RNDIS_STATUS_INVALID_DATA, "offset wraps");
+    CHECK(set_list(0xFFFFFFFAu, hdr - rel, hdr + 6, hdr + 6) == RNDIS_STATUS_INVALID_DATA, "length wraps");
+    CHECK(set_list(0, 0, 8, 8) == RNDIS_STATUS_INVALID_DATA, "truncated message");
+
+    CHECK(s_lists == lists, "a rejected list reached the driver");
+    CHECK(query_list()->InformationBufferLength == 6, "rejected list replaced the stored one");
+}
+
+static void test_halt_clears_list(void)
+{
+    set_list_ok(2);
+    memset(s_buf.ctrl, 0, sizeof(s_buf.ctrl));
+    rndis_generic_msg_t *h = (rndis_generic_msg_t *)s_buf.ctrl;
+    h->MessageType = REMOTE_NDIS_HALT_MSG;
+    h->MessageLength = 12;
+    rndis_class_set_handler(s_buf.ctrl, 12);
+    CHECK(query_list()->InformationBufferLength == 0, "halt");
+}
+
+int main(void)
+{
+    memset(s_buf.guard, 0xEE, sizeof(s_buf.guard));
+
+    test_list_round_trip();
+    test_list_rejected();
+    test_halt_clears_list();
+
+    if (s_failures) {
+        printf("%d check(s) failed\n", s_failures);
+        return 1;
+    }
+    printf("All RNDIS control message tests passed\n");
+    return 0;
+}
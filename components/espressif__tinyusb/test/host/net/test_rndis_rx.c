@@ -0,0 +1,178 @@
+/* test_rndis_rx.c
+ * Host unit tests for the RNDIS OUT parser of ecm_rndis_device.c: well-formed
+ * REMOTE_NDIS_PACKET_MSGs are delivered, malformed ones end the transfer without
+ * handing anything outside the message to the application.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+#include "rndis_protocol.h"
+
+static int s_failures;
+
+#define CHECK(cond, ...) do {                                   \
+        if (!(cond)) {                                          \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);         \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            s_failures++;                                       \
+        }                                                       \
+    } while (0)
+
+#define EP_OUT 0x02
+#define EP_IN  0x82
+
+/* ---------------- class driver entry points (usbd_pvt.h has no prototypes for them) ---------------- */
+void netd_init(void);
+uint16_t netd_open(uint8_t rhport, tusb_desc_interface_t const *itf_desc, uint16_t max_len);
+bool netd_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes);
+
+/* ---------------- usbd / application stubs ---------------- */
+static uint8_t *s_out_buf;
+
+bool usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes)
+{
+    (void)rhport; (void)total_bytes;
+    if (ep_addr == EP_OUT) s_out_buf = buffer;
+    return true;
+}
+bool usbd_edpt_busy(uint8_t rhport, uint8_t ep_addr) { (void)rhport; (void)ep_addr; return false; }
+bool usbd_edpt_claim(uint8_t rhport, uint8_t ep_addr) { (void)rhport; (void)ep_addr; return true; }
+bool usbd_edpt_open(uint8_t rhport, tusb_desc_endpoint_t const *desc) { (void)rhport; (void)desc; return true; }
+bool usbd_open_edpt_pair(uint8_t rhport, uint8_t const *p_desc, uint8_t ep_count, uint8_t xfer_type,
+                         uint8_t *ep_out, uint8_t *ep_in)
+{
+    (void)rhport; (void)p_desc; (void)ep_count; (void)xfer_type;
+    *ep_out = EP_OUT;
+    *ep_in = EP_IN;
+    return true;
+}
+bool tud_control_xfer(uint8_t rhport, tusb_control_request_t const *request, void *buffer, uint16_t len)
+{
+    (void)rhport; (void)request; (void)buffer; (void)len;
+    return true;
+}
+bool tud_control_status(uint8_t rhport, tusb_control_request_t const *request)
+{
+    (void)rhport; (void)request;
+    return true;
+}
+tusb_speed_t tud_speed_get(void) { return TUSB_SPEED_FULL; }
+void rndis_class_set_handler(uint8_t *data, int size) { (void)data; (void)size; }
+
+uint8_t tud_network_mac_address[6];
+void tud_network_init_cb(void) {}
+uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg) { (void)dst; (void)ref; return arg; }
+
+static int s_frames;
+static const uint8_t *s_frame;
+static uint16_t s_size;
+
+bool tud_network_recv_cb(const uint8_t *src, uint16_t size)
+{
+    s_frames++;
+    s_frame = src;
+    s_size = size;
+    tud_network_recv_renew();
+    return true;
+}
+
+/* ---------------- helpers ---------------- */
+/* one REMOTE_NDIS_PACKET_MSG with the payload right behind the header */
+static uint32_t put_msg(uint8_t *b, uint16_t frame_len, uint8_t fill)
+{
+    rndis_data_packet_t *h = (rndis_data_packet_t *)b;
+    memset(h, 0, sizeof(*h));
+    h->MessageType = REMOTE_NDIS_PACKET_MSG;
+    h->MessageLength = sizeof(*h) + frame_len;
+    h->DataOffset = sizeof(*h) - offsetof(rndis_data_packet_t, DataOffset);
+    h->DataLength = frame_len;
+    memset(b + sizeof(*h), fill, frame_len);
+    return h->MessageLength;
+}
+
+static void host_out(uint32_t len)
+{
+    s_out_buf = NULL;
+    netd_xfer_cb(0, EP_OUT, XFER_RESULT_SUCCESS, len);
+}
+
+static uint32_t recv_errors(void)
+{
+    tud_ecm_rndis_stats_t st;
+    tud_network_ecm_rndis_stats(&st);
+    return st.recv.errors;
+}
+
+/* ---------------- tests ---------------- */
+static void test_well_formed(void)
+{
+    s_frames = 0;
+    uint8_t *b = s_out_buf;
+    host_out(put_msg(b, 60, 0xA5));
+    CHECK(s_frames == 1 && s_size == 60 && s_frame == b + sizeof(rndis_data_packet_t) && s_frame[0] == 0xA5,
+          "frames %d size %u", s_frames, s_size);
+    CHECK(s_out_buf, "OUT buffer re-armed");
+}
+
+/* a message the host crafted to point DataOffset/DataLength outside itself is dropped */
+static void check_rejected(const char *what, uint32_t msg_len, uint32_t data_ofs, uint32_t data_len)
+{
+    s_frames = 0;
+    uint32_t errors = recv_errors();
+    uint8_t *b = s_out_buf;
+    put_msg(b, 0, 0);
+    rndis_data_packet_t *h = (rndis_data_packet_t *)b;
+    h->MessageLength = msg_len;
+    h->DataOffset = data_ofs;
+    h->DataLength = data_len;
+    host_out(msg_len);
+    CHECK(s_frames == 0, "%s: delivered %u bytes at offset %d", what, s_size,
+          s_frames ? (int)(s_frame - b) : -1);
+    CHECK(recv_errors() == errors + 1, "%s: not counted as an error", what);
+    CHECK(s_out_buf, "%s: OUT buffer re-armed", what);
+}
+
+static void test_malformed(void)
+{
+    const uint32_t hdr = sizeof(rndis_data_packet_t);
+    const uint32_t rel = offsetof(rndis_data_packet_t, DataOffset);
+    /* DataOffset inside the last 8 bytes of the message: the room left must not wrap */
+    check_rejected("offset at end", hdr, hdr, 1500);
+    check_rejected("offset in tail", hdr, hdr - rel + 1, 1500);
+    check_rejected("offset past end", hdr, hdr + 1, 1);
+    check_rejected("length past end", hdr + 64, hdr - rel, 65);
+    check_rejected("length over 64k", hdr + 64, hdr - rel, 0x10000 + 10);
+    check_rejected("length huge", hdr + 64, hdr - rel, 0xFFFFFFFFu);
+    /* the frame still fits exactly */
+    s_frames = 0;
+    uint8_t *b = s_out_buf;
+    uint32_t len = put_msg(b, 64, 0x5A);
+    host_out(len);
+    CHECK(s_frames == 1 && s_size == 64, "exact fit");
+}
+
+int main(void)
+{
+    static const uint8_t desc[] = { TUD_RNDIS_DESCRIPTOR(0, 4, 0x81, 8, EP_OUT, EP_IN, 64) };
+    netd_init();
+    /* the class driver is opened at the communication interface, after the IAD */
+    CHECK(netd_open(0, (tusb_desc_interface_t const *)(desc + 8), sizeof(desc) - 8), "open");
+    netd_rndis_initialize(16384);
+    tud_network_recv_renew();
+    CHECK(s_out_buf, "OUT armed");
+
+    test_well_formed();
+    test_malformed();
+
+    if (s_failures) {
+        printf("%d check(s) failed\n", s_failures);
+        return 1;
+    }
+    printf("All RNDIS RX tests passed\n");
+    return 0;
+}
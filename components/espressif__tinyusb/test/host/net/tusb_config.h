@@ -0,0 +1,17 @@
+/* tusb_config.h
+ * Host build of the ECM/RNDIS class driver (no MCU, no OS).
+ */
+#pragma once
+
+#define CFG_TUSB_MCU                  OPT_MCU_NONE
+#define CFG_TUSB_OS                   OPT_OS_NONE
+#define CFG_TUD_ENABLED               1
+#define CFG_TUD_MAX_SPEED             OPT_MODE_FULL_SPEED
+#define CFG_TUD_ENDPOINT0_SIZE        64
+#define TUP_DCD_ENDPOINT_MAX          8
+
+#define CFG_TUD_ECM_RNDIS             1
+#define CFG_TUD_ECM_RNDIS_OUT_BUF_N   2
+#define CFG_TUD_ECM_RNDIS_IN_BUF_N    2
+#define CFG_TUD_RNDIS_MAX_PACKETS_PER_XFER 4
+#define CFG_TUD_NET_MC_FILTER_N       4
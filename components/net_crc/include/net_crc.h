@@ -0,0 +1,39 @@
+/* net_crc.h
+ * CRC-32 of IEEE 802.3 (reflected polynomial 0xEDB88320) for the Ethernet FCS appended to
+ * datagrams in the NCM CRC mode.
+ *
+ * Slicing-by-8: eight 256-entry tables (8 KiB in RAM, built on first use) consume 8 bytes per
+ * iteration from two aligned 32-bit loads, where the classic byte-wise table walk needs one
+ * dependent lookup per byte.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* CRC over a valid frame followed by its FCS (little-endian) */
+#define NET_CRC32_RESIDUE 0x2144DF1Cu
+
+/* Update crc (0 to start) with len bytes, zlib convention: the result is final and can be chained.
+   Any alignment and length. */
+uint32_t net_crc32(uint32_t crc, const void *data, size_t len);
+
+/* Build the tables ahead of the first net_crc32() call (optional) */
+void net_crc32_init(void);
+
+/* Write the FCS of a frame, least significant byte first as on the wire */
+static inline void net_crc32_put_le(uint8_t *dst, uint32_t crc)
+{
+    dst[0] = (uint8_t)crc;
+    dst[1] = (uint8_t)(crc >> 8);
+    dst[2] = (uint8_t)(crc >> 16);
+    dst[3] = (uint8_t)(crc >> 24);
+}
+
+#ifdef __cplusplus
+}
+#endif
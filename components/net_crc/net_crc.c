@@ -0,0 +1,69 @@
+/* net_crc.c
+ * CRC-32 helpers (see net_crc.h).
+ */
+
+#include <stdbool.h>
+
+#include "net_crc.h"
+
+#define CRC32_POLY 0xEDB88320u
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define CRC_SLICE_BY_8 0 /* the word kernel below assumes little-endian loads */
+#else
+#define CRC_SLICE_BY_8 1
+#endif
+
+/* s_table[0] is the byte-wise table, s_table[k][i] the CRC of byte i followed by k zero bytes */
+static uint32_t s_table[8][256];
+static volatile bool s_table_ready;
+
+void net_crc32_init(void)
+{
+    if (s_table_ready) return;
+    /* a concurrent first call only rewrites every entry with the value it already holds */
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int b = 0; b < 8; ++b) c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        s_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int k = 1; k < 8; ++k) {
+            s_table[k][i] = (s_table[k - 1][i] >> 8) ^ s_table[0][s_table[k - 1][i] & 0xFF];
+        }
+    }
+    s_table_ready = true;
+}
+
+uint32_t net_crc32(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    net_crc32_init();
+    crc = ~crc;
+
+#if CRC_SLICE_BY_8
+    /* head: bytes up to the first 4-byte boundary (unaligned loads trap on Xtensa) */
+    while (len && ((uintptr_t)p & 3)) {
+        crc = (crc >> 8) ^ s_table[0][(crc ^ *p++) & 0xFF];
+        len--;
+    }
+
+    while (len >= 8) {
+        uint32_t a = ((const uint32_t *)(const void *)p)[0] ^ crc;
+        uint32_t b = ((const uint32_t *)(const void *)p)[1];
+        crc = s_table[7][a & 0xFF] ^ s_table[6][(a >> 8) & 0xFF] ^
+              s_table[5][(a >> 16) & 0xFF] ^ s_table[4][a >> 24] ^
+              s_table[3][b & 0xFF] ^ s_table[2][(b >> 8) & 0xFF] ^
+              s_table[1][(b >> 16) & 0xFF] ^ s_table[0][b >> 24];
+        p += 8;
+        len -= 8;
+    }
+#endif
+
+    /* tail */
+    while (len--) {
+        crc = (crc >> 8) ^ s_table[0][(crc ^ *p++) & 0xFF];
+    }
+    return ~crc;
+}
@@ -0,0 +1,91 @@
+/* test_net_crc.c
+ * Host unit tests for net_crc: check values, the slicing kernel against a bit-wise reference
+ * over all alignments, chaining and the FCS residue.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "net_crc.h"
+
+static int s_failures;
+
+#define CHECK(cond, ...) do {                                   \
+        if (!(cond)) {                                          \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);         \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            s_failures++;                                       \
+        }                                                       \
+    } while (0)
+
+/* bit at a time reference */
+static uint32_t ref_crc32(const uint8_t *p, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    while (len--) {
+        crc ^= *p++;
+        for (int b = 0; b < 8; ++b) crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+    }
+    return ~crc;
+}
+
+static void test_check_values(void)
+{
+    CHECK(net_crc32(0, "123456789", 9) == 0xCBF43926u, "check value %08x", net_crc32(0, "123456789", 9));
+    CHECK(net_crc32(0, "", 0) == 0, "empty");
+    CHECK(net_crc32(0x1234, "", 0) == 0x1234, "empty keeps the running value");
+}
+
+static void test_all_alignments(void)
+{
+    static uint8_t buf[1600 + 8];
+    for (size_t i = 0; i < sizeof(buf); ++i) buf[i] = (uint8_t)rand();
+    for (size_t align = 0; align < 8; ++align) {
+        for (size_t len = 0; len <= 1514; len += (len < 80 ? 1 : 37)) {
+            uint32_t want = ref_crc32(buf + align, len);
+            uint32_t got = net_crc32(0, buf + align, len);
+            CHECK(got == want, "align %zu len %zu: got %08x want %08x", align, len, got, want);
+        }
+    }
+}
+
+static void test_chaining(void)
+{
+    uint8_t buf[301];
+    for (size_t i = 0; i < sizeof(buf); ++i) buf[i] = (uint8_t)rand();
+    for (size_t cut = 0; cut <= sizeof(buf); ++cut) {
+        uint32_t crc = net_crc32(0, buf, cut);
+        crc = net_crc32(crc, buf + cut, sizeof(buf) - cut);
+        CHECK(crc == ref_crc32(buf, sizeof(buf)), "cut %zu", cut);
+    }
+}
+
+static void test_fcs_residue(void)
+{
+    static uint8_t frame[1514 + 4];
+    for (int iter = 0; iter < 200; ++iter) {
+        size_t len = 60 + (size_t)(rand() % (1514 - 60 + 1));
+        for (size_t i = 0; i < len; ++i) frame[i] = (uint8_t)rand();
+        net_crc32_put_le(frame + len, net_crc32(0, frame, len));
+        CHECK(net_crc32(0, frame, len + 4) == NET_CRC32_RESIDUE, "residue len %zu", len);
+        frame[rand() % len] ^= (uint8_t)(1 + rand() % 255);
+        CHECK(net_crc32(0, frame, len + 4) != NET_CRC32_RESIDUE, "corruption undetected len %zu", len);
+    }
+}
+
+int main(void)
+{
+    srand(802);
+    test_check_values();
+    test_all_alignments();
+    test_chaining();
+    test_fcs_residue();
+    if (s_failures) {
+        printf("%d check(s) failed\n", s_failures);
+        return 1;
+    }
+    printf("All net_crc tests passed\n");
+    return 0;
+}
@@ -0,0 +1,71 @@
+/* net_csum.h
+ * Internet checksum helpers for the forwarding path.
+ *
+ * Convention: 16-bit fields and checksums are passed as numeric values of the network-order
+ * field (i.e. what ntohs() would return); deltas are unfolded one's complement sums.
+ *
+ * Full sums: net_csum_partial() walks the buffer a 32-bit word at a time, 8 words per
+ * iteration, on 4-byte aligned loads (unaligned loads trap on Xtensa).
+ * Incremental updates: RFC 1624 eqn. 3, HC' = ~(~HC + ~m + m').
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One's complement sum of len bytes added to sum (unfolded). Any alignment and length. */
+uint32_t net_csum_partial(const void *data, size_t len, uint32_t sum);
+
+/* Fold an unfolded sum to 16 bits (not complemented) */
+static inline uint16_t net_csum_fold(uint32_t sum)
+{
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
+/* Full Internet checksum of a buffer (e.g. an IPv4 header with its checksum field zeroed) */
+static inline uint16_t net_csum(const void *data, size_t len)
+{
+    return (uint16_t)~net_csum_fold(net_csum_partial(data, len, 0));
+}
+
+/* Delta for replacing the 16-bit word old_v by new_v */
+static inline uint32_t net_csum_delta16(uint16_t old_v, uint16_t new_v)
+{
+    return (uint32_t)(uint16_t)~old_v + new_v;
+}
+
+/* Delta for replacing the network-order bytes old_v[0..2*words) by new_v (addresses, ports) */
+uint32_t net_csum_delta(const void *old_v, const void *new_v, size_t words);
+
+/* Apply an accumulated delta to a checksum field value */
+static inline uint16_t net_csum_apply(uint16_t csum, uint32_t delta)
+{
+    return (uint16_t)~net_csum_fold((uint32_t)(uint16_t)~csum + net_csum_fold(delta));
+}
+
+/* RFC 1624 update for a single changed 16-bit word */
+static inline uint16_t net_csum_update16(uint16_t csum, uint16_t old_v, uint16_t new_v)
+{
+    return net_csum_apply(csum, net_csum_delta16(old_v, new_v));
+}
+
+/* UDP over IPv4: 0 means "no checksum", a computed 0 is sent as 0xFFFF */
+static inline uint16_t net_csum_apply_udp(uint16_t csum, uint32_t delta)
+{
+    if (csum == 0) return 0;
+    csum = net_csum_apply(csum, delta);
+    return csum ? csum : 0xFFFF;
+}
+
+/* Decrement the TTL of an IPv4 header (raw bytes) and patch its header checksum */
+void net_csum_ipv4_dec_ttl(uint8_t *iph);
+
+#ifdef __cplusplus
+}
+#endif
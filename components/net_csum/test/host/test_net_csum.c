@@ -0,0 +1,170 @@
+/* test_net_csum.c
+ * Host unit tests for net_csum: full sums against a byte-wise reference, and incremental
+ * updates against full recomputation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "net_csum.h"
+
+static int s_failures;
+
+#define CHECK(cond, ...) do {                                   \
+        if (!(cond)) {                                          \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);         \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+            s_failures++;                                       \
+        }                                                       \
+    } while (0)
+
+/* RFC 1071 reference: big-endian 16-bit words, odd byte padded */
+static uint16_t ref_csum(const uint8_t *p, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2) sum += (uint32_t)(p[i] << 8 | p[i + 1]);
+    if (len & 1) sum += (uint32_t)p[len - 1] << 8;
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+static uint16_t rd16(const uint8_t *p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static void wr16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v & 0xFF; }
+
+static void test_full_sum_all_alignments(void)
+{
+    static uint8_t buf[1600 + 8];
+    for (size_t i = 0; i < sizeof(buf); ++i) buf[i] = (uint8_t)rand();
+    for (size_t align = 0; align < 8; ++align) {
+        for (size_t len = 0; len <= 1514; len += (len < 80 ? 1 : 37)) {
+            uint16_t want = ref_csum(buf + align, len);
+            uint16_t got = net_csum(buf + align, len);
+            CHECK(got == want, "align %zu len %zu: got %04x want %04x", align, len, got, want);
+        }
+    }
+}
+
+static void test_partial_chaining(void)
+{
+    uint8_t buf[301];
+    for (size_t i = 0; i < sizeof(buf); ++i) buf[i] = (uint8_t)rand();
+    /* split at even offsets: sums of the parts add up */
+    for (size_t cut = 0; cut <= sizeof(buf); cut += 2) {
+        uint32_t s = net_csum_partial(buf, cut, 0);
+        s = net_csum_partial(buf + cut, sizeof(buf) - cut, s);
+        uint16_t got = (uint16_t)~net_csum_fold(s);
+        CHECK(got == ref_csum(buf, sizeof(buf)), "cut %zu", cut);
+    }
+}
+
+static void test_all_ones(void)
+{
+    /* worst case for carries */
+    static uint8_t buf[1514];
+    memset(buf, 0xFF, sizeof(buf));
+    CHECK(net_csum(buf, sizeof(buf)) == ref_csum(buf, sizeof(buf)), "0xFF buffer");
+}
+
+static void test_rfc1624_example(void)
+{
+    /* RFC 1624 section 4: HC=0xDD2F, m=0x5555 -> m'=0x3285 gives HC'=0x0000, not 0xFFFF */
+    CHECK(net_csum_update16(0xDD2F, 0x5555, 0x3285) == 0x0000, "got %04x",
+          net_csum_update16(0xDD2F, 0x5555, 0x3285));
+}
+
+/* Build a random IPv4/TCP or UDP packet with valid checksums */
+static size_t make_packet(uint8_t *pkt, size_t payload, int udp)
+{
+    size_t l4_len = (udp ? 8 : 20) + payload;
+    memset(pkt, 0, 20 + l4_len);
+    pkt[0] = 0x45;
+    wr16(pkt + 2, (uint16_t)(20 + l4_len));
+    wr16(pkt + 4, (uint16_t)rand());
+    pkt[8] = (uint8_t)(2 + rand() % 250);
+    pkt[9] = udp ? 17 : 6;
+    for (int i = 12; i < 20; ++i) pkt[i] = (uint8_t)rand();
+    for (size_t i = 20; i < 20 + l4_len; ++i) pkt[i] = (uint8_t)rand();
+    uint8_t *l4 = pkt + 20;
+    if (udp) wr16(l4 + 4, (uint16_t)l4_len);
+    else l4[12] = 0x50;
+    wr16(pkt + 10, 0);
+    wr16(pkt + 10, net_csum(pkt, 20));
+
+    int csum_off = udp ? 6 : 16;
+    wr16(l4 + csum_off, 0);
+    uint8_t pseudo[12];
+    memcpy(pseudo, pkt + 12, 8);
+    pseudo[8] = 0;
+    pseudo[9] = pkt[9];
+    wr16(pseudo + 10, (uint16_t)l4_len);
+    uint32_t s = net_csum_partial(pseudo, sizeof(pseudo), 0);
+    s = net_csum_partial(l4, l4_len, s);
+    uint16_t c = (uint16_t)~net_csum_fold(s);
+    if (udp && c == 0) c = 0xFFFF;
+    wr16(l4 + csum_off, c);
+    return 20 + l4_len;
+}
+
+/* Verify IP header and L4 checksums of a packet built by make_packet */
+static int packet_valid(const uint8_t *pkt)
+{
+    size_t len = rd16(pkt + 2);
+    if (ref_csum(pkt, 20) != 0) return 0;
+    uint8_t pseudo[12];
+    memcpy(pseudo, pkt + 12, 8);
+    pseudo[8] = 0;
+    pseudo[9] = pkt[9];
+    wr16(pseudo + 10, (uint16_t)(len - 20));
+    uint32_t s = net_csum_partial(pseudo, sizeof(pseudo), 0);
+    s = net_csum_partial(pkt + 20, len - 20, s);
+    return net_csum_fold(s) == 0xFFFF;
+}
+
+static void test_nat_rewrite(void)
+{
+    static uint8_t pkt[1514];
+    for (int iter = 0; iter < 2000; ++iter) {
+        int udp = iter & 1;
+        make_packet(pkt, (size_t)(rand() % 1400), udp);
+        CHECK(packet_valid(pkt), "generated packet invalid");
+
+        /* SNAT: source address + source port, like the forwarding glue */
+        uint8_t new_ip[4], new_port[2];
+        for (int i = 0; i < 4; ++i) new_ip[i] = (uint8_t)rand();
+        wr16(new_port, (uint16_t)rand());
+        uint32_t ip_delta = net_csum_delta(pkt + 12, new_ip, 2);
+        uint32_t l4_delta = ip_delta + net_csum_delta(pkt + 20, new_port, 1);
+        memcpy(pkt + 12, new_ip, 4);
+        memcpy(pkt + 20, new_port, 2);
+        wr16(pkt + 10, net_csum_apply(rd16(pkt + 10), ip_delta));
+        uint8_t *c = pkt + 20 + (udp ? 6 : 16);
+        wr16(c, udp ? net_csum_apply_udp(rd16(c), l4_delta) : net_csum_apply(rd16(c), l4_delta));
+        net_csum_ipv4_dec_ttl(pkt);
+
+        CHECK(packet_valid(pkt), "iteration %d (%s) invalid after rewrite", iter, udp ? "udp" : "tcp");
+    }
+}
+
+static void test_udp_zero_checksum_kept(void)
+{
+    CHECK(net_csum_apply_udp(0, net_csum_delta16(0x1234, 0x4321)) == 0, "UDP 0 checksum must stay 0");
+}
+
+int main(void)
+{
+    srand(1624);
+    test_full_sum_all_alignments();
+    test_partial_chaining();
+    test_all_ones();
+    test_rfc1624_example();
+    test_nat_rewrite();
+    test_udp_zero_checksum_kept();
+    if (s_failures) {
+        printf("%d check(s) failed\n", s_failures);
+        return 1;
+    }
+    printf("All net_csum tests passed\n");
+    return 0;
+}
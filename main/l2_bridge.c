@@ -0,0 +1,294 @@
+/* l2_bridge.c
+ * Layer-2 USB <-> WiFi STA bridge with MAC-NAT (see l2_bridge.h).
+ *
+ * Uplink (TinyUSB task): host frame -> learn (IPv4, MAC) -> source MAC (and ARP sender MAC)
+ *   rewritten to the STA MAC -> esp_wifi_internal_tx().
+ * Downlink (WiFi task): STA RX callback -> unicast for a learned host gets its destination MAC
+ *   (and ARP target MAC) restored and goes to the USB TX backlog; broadcast/multicast goes to
+ *   both the host and lwIP; everything else is handed to lwIP as before.
+ */
+
+#include <string.h>
+#include <stdatomic.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "esp_private/wifi.h" // esp_wifi_internal_tx, esp_wifi_internal_reg_rxcb
+
+#include "net_csum.h"
+#include "l2_bridge.h"
+#include "mss_clamp.h"
+
+static const char *TAG = "l2_bridge";
+
+#define ETH_HDR_LEN     14
+#define ETH_ADDR_LEN    6
+#define ETHTYPE_IPV4    0x0800
+#define ETHTYPE_ARP     0x0806
+#define ETHTYPE_IPV6    0x86DD
+#define IP_PROTO_UDP    17
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+#define DHCP_OP_REPLY   2
+#define BOOTP_FLAG_BROADCAST 0x8000
+
+/* ARP (Ethernet/IPv4) payload offsets */
+#define ARP_SHA 8
+#define ARP_SPA 14
+#define ARP_THA 18
+#define ARP_TPA 24
+#define ARP_LEN 28
+
+#define BRIDGE_MAX_FRAME 1536
+
+typedef struct {
+    uint32_t ip;                /* network order, 0 = unused */
+    uint8_t mac[ETH_ADDR_LEN];
+    TickType_t seen;
+} bridge_host_t;
+
+static esp_netif_t *s_sta_netif;
+static l2_bridge_usb_tx_fn s_usb_tx;
+static uint8_t s_sta_mac[ETH_ADDR_LEN];
+static uint8_t s_local_mac[ETH_ADDR_LEN];   /* USB netif MAC: frames for the dongle itself */
+
+static bridge_host_t s_hosts[CONFIG_DONGLE_L2_BRIDGE_MAX_HOSTS];
+static uint8_t s_last_host_mac[ETH_ADDR_LEN]; /* fallback for non-IPv4 unicast (IPv6) */
+static bool s_have_last_host;
+static portMUX_TYPE s_hosts_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* uplink scratch buffer, TinyUSB task only */
+static uint8_t s_up_buf[BRIDGE_MAX_FRAME];
+
+static atomic_uint s_up_fwd, s_up_drop, s_down_fwd, s_down_drop;
+
+static inline uint16_t rd16(const uint8_t *p) { return (uint16_t)((p[0] << 8) | p[1]); }
+static inline void wr16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v & 0xFF; }
+static inline uint32_t rd32_raw(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+static void hosts_learn(uint32_t ip, const uint8_t *mac)
+{
+    if (ip == 0 || ip == 0xFFFFFFFFu || (mac[0] & 1)) return;
+    TickType_t now = xTaskGetTickCount();
+    taskENTER_CRITICAL(&s_hosts_lock);
+    /* existing entry, else an empty slot, else the least recently seen one */
+    bridge_host_t *slot = &s_hosts[0];
+    for (int i = 0; i < CONFIG_DONGLE_L2_BRIDGE_MAX_HOSTS; ++i) {
+        bridge_host_t *h = &s_hosts[i];
+        if (h->ip == ip) {
+            slot = h;
+            break;
+        }
+        if (!slot->ip) continue;
+        if (!h->ip || (now - h->seen) > (now - slot->seen)) slot = h;
+    }
+    slot->ip = ip;
+    memcpy(slot->mac, mac, ETH_ADDR_LEN);
+    slot->seen = now;
+    memcpy(s_last_host_mac, mac, ETH_ADDR_LEN);
+    s_have_last_host = true;
+    taskEXIT_CRITICAL(&s_hosts_lock);
+}
+
+static bool hosts_lookup(uint32_t ip, uint8_t *mac_out)
+{
+    bool found = false;
+    taskENTER_CRITICAL(&s_hosts_lock);
+    for (int i = 0; i < CONFIG_DONGLE_L2_BRIDGE_MAX_HOSTS; ++i) {
+        if (s_hosts[i].ip && s_hosts[i].ip == ip) {
+            memcpy(mac_out, s_hosts[i].mac, ETH_ADDR_LEN);
+            found = true;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&s_hosts_lock);
+    return found;
+}
+
+static bool hosts_last(uint8_t *mac_out)
+{
+    taskENTER_CRITICAL(&s_hosts_lock);
+    bool ok = s_have_last_host;
+    if (ok) memcpy(mac_out, s_last_host_mac, ETH_ADDR_LEN);
+    taskEXIT_CRITICAL(&s_hosts_lock);
+    return ok;
+}
+
+void l2_bridge_flush(void)
+{
+    taskENTER_CRITICAL(&s_hosts_lock);
+    memset(s_hosts, 0, sizeof(s_hosts));
+    s_have_last_host = false;
+    taskEXIT_CRITICAL(&s_hosts_lock);
+}
+
+/* Locate the UDP header of an IPv4 DHCP packet between the given ports; NULL otherwise */
+static uint8_t *dhcp_udp_header(uint8_t *frame, uint16_t len, uint16_t sport, uint16_t dport)
+{
+    uint8_t *ip = frame + ETH_HDR_LEN;
+    if (len < ETH_HDR_LEN + 20 || ip[9] != IP_PROTO_UDP) return NULL;
+    if (rd16(ip + 6) & 0x3FFF) return NULL; /* fragment */
+    uint16_t ihl = (ip[0] & 0x0F) * 4;
+    uint8_t *udp = ip + ihl;
+    /* UDP header + BOOTP fixed part up to chaddr */
+    if (ihl < 20 || udp + 8 + 34 > frame + len) return NULL;
+    if (rd16(udp) != sport || rd16(udp + 2) != dport) return NULL;
+    return udp;
+}
+
+/* ---------------- uplink: host -> WiFi ---------------- */
+bool l2_bridge_from_usb(const uint8_t *frame, uint16_t len)
+{
+    if (len < ETH_HDR_LEN) return false;
+    if (memcmp(frame, s_local_mac, ETH_ADDR_LEN) == 0) return false; /* for the dongle itself */
+    if (len > sizeof(s_up_buf)) {
+        atomic_fetch_add(&s_up_drop, 1);
+        return true;
+    }
+
+    uint8_t *f = s_up_buf;
+    memcpy(f, frame, len);
+    uint16_t type = rd16(f + 12);
+
+    if (type == ETHTYPE_IPV4 && len >= ETH_HDR_LEN + 20) {
+        hosts_learn(rd32_raw(f + ETH_HDR_LEN + 12), f + ETH_ADDR_LEN);
+#if CONFIG_DONGLE_TCP_MSS_CLAMP
+        mss_clamp_frame(f, len, MSS_CLAMP_USB_TO_WIFI, 0);
+#endif
+        /* DHCP: the upstream server would unicast its reply to chaddr (the host MAC), which the AP
+           does not know. Ask for a broadcast reply instead; the ACK is snooped on the way back. */
+        uint8_t *udp = dhcp_udp_header(f, len, DHCP_CLIENT_PORT, DHCP_SERVER_PORT);
+        if (udp) {
+            uint8_t *flags = udp + 8 + 10;
+            uint16_t old_flags = rd16(flags);
+            uint16_t new_flags = old_flags | BOOTP_FLAG_BROADCAST;
+            if (new_flags != old_flags) {
+                wr16(flags, new_flags);
+                wr16(udp + 6, net_csum_apply_udp(rd16(udp + 6), net_csum_delta16(old_flags, new_flags)));
+            }
+        }
+    } else if (type == ETHTYPE_ARP && len >= ETH_HDR_LEN + ARP_LEN) {
+        uint8_t *arp = f + ETH_HDR_LEN;
+        hosts_learn(rd32_raw(arp + ARP_SPA), arp + ARP_SHA);
+        memcpy(arp + ARP_SHA, s_sta_mac, ETH_ADDR_LEN);
+    } else if (type == ETHTYPE_IPV6) {
+        taskENTER_CRITICAL(&s_hosts_lock);
+        memcpy(s_last_host_mac, f + ETH_ADDR_LEN, ETH_ADDR_LEN);
+        s_have_last_host = true;
+        taskEXIT_CRITICAL(&s_hosts_lock);
+    }
+
+    memcpy(f + ETH_ADDR_LEN, s_sta_mac, ETH_ADDR_LEN);
+    if (esp_wifi_internal_tx(WIFI_IF_STA, f, len) == ESP_OK) {
+        atomic_fetch_add(&s_up_fwd, 1);
+    } else {
+        atomic_fetch_add(&s_up_drop, 1);
+    }
+    return true;
+}
+
+/* ---------------- downlink: WiFi -> host ---------------- */
+static void to_usb(const uint8_t *frame, uint16_t len, const uint8_t *host_mac, bool is_arp)
+{
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, len, PBUF_RAM);
+    if (!p) {
+        atomic_fetch_add(&s_down_drop, 1);
+        return;
+    }
+    uint8_t *f = p->payload;
+    memcpy(f, frame, len);
+    if (host_mac) {
+        memcpy(f, host_mac, ETH_ADDR_LEN);
+        if (is_arp) memcpy(f + ETH_HDR_LEN + ARP_THA, host_mac, ETH_ADDR_LEN);
+    }
+#if CONFIG_DONGLE_TCP_MSS_CLAMP
+    if (!is_arp) mss_clamp_frame(f, len, MSS_CLAMP_WIFI_TO_USB, 0);
+#endif
+    if (s_usb_tx(p) == ESP_OK) {
+        atomic_fetch_add(&s_down_fwd, 1);
+    } else {
+        atomic_fetch_add(&s_down_drop, 1);
+    }
+}
+
+/* Replaces esp-netif's STA RX callback; frames not meant for the host continue into lwIP */
+static esp_err_t bridge_wifi_rx(void *buffer, uint16_t len, void *eb)
+{
+    const uint8_t *f = buffer;
+    if (len < ETH_HDR_LEN) {
+        return esp_netif_receive(s_sta_netif, buffer, len, eb);
+    }
+    uint16_t type = rd16(f + 12);
+
+    if (f[0] & 1) {
+        /* broadcast/multicast: the host and the dongle both get a copy */
+        if (type == ETHTYPE_IPV4) {
+            uint8_t *udp = dhcp_udp_header(buffer, len, DHCP_SERVER_PORT, DHCP_CLIENT_PORT);
+            if (udp && udp[8] == DHCP_OP_REPLY) {
+                const uint8_t *bootp = udp + 8;
+                /* snoop the lease so unicast reaches the host before it sends anything itself */
+                uint32_t yiaddr = rd32_raw(bootp + 16);
+                if (memcmp(bootp + 28, s_sta_mac, ETH_ADDR_LEN) != 0) hosts_learn(yiaddr, bootp + 28);
+            }
+        }
+        /* the AP repeats our own group-addressed frames back into the BSS */
+        if (memcmp(f + ETH_ADDR_LEN, s_sta_mac, ETH_ADDR_LEN) != 0) to_usb(f, len, NULL, false);
+        return esp_netif_receive(s_sta_netif, buffer, len, eb);
+    }
+
+    uint8_t host_mac[ETH_ADDR_LEN];
+    bool is_arp = false, found = false;
+    if (type == ETHTYPE_IPV4 && len >= ETH_HDR_LEN + 20) {
+        found = hosts_lookup(rd32_raw(f + ETH_HDR_LEN + 16), host_mac);
+    } else if (type == ETHTYPE_ARP && len >= ETH_HDR_LEN + ARP_LEN) {
+        is_arp = true;
+        found = hosts_lookup(rd32_raw(f + ETH_HDR_LEN + ARP_TPA), host_mac);
+    } else if (type == ETHTYPE_IPV6) {
+        found = hosts_last(host_mac); /* lwIP here runs without IPv6 */
+    }
+    if (!found) {
+        return esp_netif_receive(s_sta_netif, buffer, len, eb);
+    }
+
+    to_usb(f, len, host_mac, is_arp);
+    esp_wifi_internal_free_rx_buffer(eb);
+    return ESP_OK;
+}
+
+/* ---------------- setup ---------------- */
+esp_err_t l2_bridge_init(esp_netif_t *sta_netif, esp_netif_t *usb_netif, l2_bridge_usb_tx_fn usb_tx)
+{
+    if (!sta_netif || !usb_netif || !usb_tx) return ESP_ERR_INVALID_ARG;
+    s_sta_netif = sta_netif;
+    s_usb_tx = usb_tx;
+    esp_err_t rc = esp_wifi_get_mac(WIFI_IF_STA, s_sta_mac);
+    if (rc != ESP_OK) return rc;
+    rc = esp_netif_get_mac(usb_netif, s_local_mac);
+    if (rc != ESP_OK) return rc;
+    l2_bridge_flush();
+    ESP_LOGI(TAG, "bridge ready: STA MAC " MACSTR ", local USB MAC " MACSTR,
+             MAC2STR(s_sta_mac), MAC2STR(s_local_mac));
+    return ESP_OK;
+}
+
+esp_err_t l2_bridge_attach_wifi(void)
+{
+    if (!s_sta_netif) return ESP_ERR_INVALID_STATE;
+    return esp_wifi_internal_reg_rxcb(WIFI_IF_STA, bridge_wifi_rx);
+}
+
+void l2_bridge_log_stats(void)
+{
+    static unsigned last_up, last_up_drop, last_down, last_down_drop;
+    unsigned up = atomic_load(&s_up_fwd), up_drop = atomic_load(&s_up_drop);
+    unsigned down = atomic_load(&s_down_fwd), down_drop = atomic_load(&s_down_drop);
+    if (up == last_up && up_drop == last_up_drop && down == last_down && down_drop == last_down_drop) return;
+    ESP_LOGI(TAG, "bridged: up=%u (drop %u) down=%u (drop %u)", up, up_drop, down, down_drop);
+    last_up = up;
+    last_up_drop = up_drop;
+    last_down = down;
+    last_down_drop = down_drop;
+}
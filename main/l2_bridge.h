@@ -0,0 +1,44 @@
+/* l2_bridge.h
+ * Layer-2 bridge between the USB netif and the WiFi STA interface (MAC-NAT).
+ *
+ * A WiFi station may only send frames with its own MAC as source, so host frames are
+ * forwarded with the source MAC rewritten to the STA MAC; an IPv4 -> host MAC table
+ * learned from host ARP/IPv4 traffic and upstream DHCP ACKs maps replies back.
+ * Forwarded frames never enter lwIP.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_netif.h"
+#include "lwip/pbuf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Queue a frame towards the USB host. Takes ownership of p (one reference). */
+typedef esp_err_t (*l2_bridge_usb_tx_fn)(struct pbuf *p);
+
+/* Call once before USB or WiFi traffic flows. usb_netif frames addressed to its MAC stay local. */
+esp_err_t l2_bridge_init(esp_netif_t *sta_netif, esp_netif_t *usb_netif, l2_bridge_usb_tx_fn usb_tx);
+
+/* Take over the STA RX path. Must run after esp-netif registered its own RX callback,
+   i.e. from the WIFI_EVENT_STA_CONNECTED handler. */
+esp_err_t l2_bridge_attach_wifi(void);
+
+/* TinyUSB task: frame from the host. Returns true if it was forwarded (or dropped) by the bridge,
+   false if it is addressed to the dongle itself and should go to lwIP. src is not modified. */
+bool l2_bridge_from_usb(const uint8_t *frame, uint16_t len);
+
+/* Forget learned hosts (e.g. on USB detach or WiFi reconnect) */
+void l2_bridge_flush(void);
+
+/* Log forwarding counters if any of them moved since the last call */
+void l2_bridge_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,28 +1,34 @@
 /* main.c
- * ESP32-S3 WiFi STA -> USB ECM/RNDIS dongle (robust, IDF v5.x)
+ * ESP32-S3 WiFi STA -> USB NCM or ECM/RNDIS dongle (robust, IDF v5.x)
  *
  * Requirements:
  *  - main/tusb_desc.c exports:
  *      extern const tusb_desc_device_t desc_device;
  *      extern const uint8_t desc_fs_configuration[];
  *  - In menuconfig: enable LWIP IPv4, DHCPS, NAPT if you want NAT; disable TinyUSB auto-descriptors if using custom tusb_desc.c.
+ *  - The class driver follows CONFIG_TINYUSB_NET_MODE_* (esp_tinyusb's tusb_config.h); tusb_desc.c
+ *    provides the matching NCM or ECM descriptor.
  */
 
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <arpa/inet.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/event_groups.h"
 
 #include "esp_event.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
 #include "esp_system.h"
 #include "esp_err.h"
+#include "esp_timer.h"
 
 #include "esp_netif.h"
 #include "esp_netif_ip_addr.h"
@@ -35,18 +41,24 @@
 #include "lwip/ip4_addr.h"
 #include "lwip/netif.h"
 #include "lwip/tcpip.h"
+#include "netif/ethernet.h" // ethernet_input
 
 #include "tinyusb.h"
 #include "tusb.h"
+#include "device/usbd_pvt.h" // usbd_defer_func
+#if CFG_TUD_NCM
+#include "class/net/ncm.h"    // CFG_TUD_NCM_OUT_DATAGRAM_TABLE_N
+#endif
+
+#include "l2_bridge.h"
+#include "napt_fastpath.h"
+#include "mss_clamp.h"
+#include "net_crc.h"
 
 /* Descriptors provided by main/tusb_desc.c */
 extern const tusb_desc_device_t desc_device;
 extern const uint8_t desc_fs_configuration[];
 
-/* Some TinyUSB wrappers provide tud_network_xmit(void *pbuf, uint16_t arg).
-   If your wrapper exposes another API, adapt usb_driver_transmit. */
-extern void tud_network_xmit(void *pbuf_ptr, uint16_t arg);
-
 #ifndef CONFIG_WIFI_SSID
 #define CONFIG_WIFI_SSID "OPT-WIFII"
 #endif
@@ -61,13 +73,43 @@ static esp_netif_t *sta_netif = NULL;
 static esp_netif_t *usb_netif = NULL;
 
 /* TinyUSB strings (index 0 reserved) */
+/* Index 4 is the iMACAddress string: the host-side MAC, filled in from tud_network_mac_address */
+static char s_host_mac_str[13];
 static const char *tusb_strings[] = {
     "", /* lang placeholder */
-    "Espressif", "ESP32-S3 ECM Dongle", "esp32s3-001", "001122334455"
+#if CFG_TUD_NCM
+    "Espressif", "ESP32-S3 NCM Dongle", "esp32s3-001", s_host_mac_str
+#else
+    "Espressif", "ESP32-S3 ECM Dongle", "esp32s3-001", s_host_mac_str
+#endif
 };
 #define ARRAY_SIZE(a) (sizeof(a)/sizeof((a)[0]))
 
-/* USB MAC (locally administered) */
+/* App-level work is event driven: callbacks (TinyUSB task, esp_event task) only set bits here and
+   app_main's loop does the slow, blocking part. The TinyUSB task is the only tud_task() consumer.
+   Configuring the USB address and DHCP server retries for seconds: with NAPT it has a task of its
+   own (usb_ip_task), so WiFi reconnects and USB link updates do not wait behind it. */
+static EventGroupHandle_t s_app_events;
+#define APP_EV_USB_NET_INIT     BIT0 /* host configured the network interface: (re)start DHCP server */
+#define APP_EV_WIFI_GOT_IP      BIT1 /* STA got an address: enable NAPT, follow it on USB */
+#define APP_EV_WIFI_DISCONNECTED BIT2 /* STA lost the AP: reconnect */
+#define APP_EV_WIFI_CONNECTED   BIT3 /* STA associated: report the link to the USB host */
+#if CONFIG_DONGLE_FORWARD_L2_BRIDGE
+#define APP_EV_LOOP (APP_EV_USB_NET_INIT | APP_EV_WIFI_DISCONNECTED | APP_EV_WIFI_CONNECTED)
+#else
+#define APP_EV_LOOP (APP_EV_WIFI_DISCONNECTED | APP_EV_WIFI_CONNECTED)
+#define APP_EV_USB_IP (APP_EV_USB_NET_INIT | APP_EV_WIFI_GOT_IP)
+#endif
+#define APP_STATS_PERIOD_MS     10000
+
+/* latest STA address, written by got_ip_handler, consumed by usb_ip_task */
+static esp_netif_ip_info_t s_wifi_ipinfo;
+static portMUX_TYPE s_wifi_ipinfo_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* MAC addresses of the USB link (locally administered). The class drivers read
+   tud_network_mac_address as the host's address (RNDIS permanent address, iMACAddress string);
+   the dongle's own end of the link uses s_usb_mac. */
+uint8_t tud_network_mac_address[6] = { 0x02, 0x00, 0x11, 0x22, 0x33, 0x45 };
 static uint8_t s_usb_mac[6] = { 0x02, 0x00, 0x11, 0x22, 0x33, 0x44 };
 
 /* Helper type to deliver pbuf to tcpip thread */
@@ -76,6 +118,181 @@ typedef struct {
     struct netif *n;
 } recv_arg_t;
 
+#if CONFIG_DONGLE_USB_RX_ZERO_COPY
+/* Zero-copy RX: the frames stay in the TinyUSB RX buffer (ECM/RNDIS endpoint buffer, NCM NTB) and
+   are wrapped in PBUF_REF custom pbufs. The class driver delivers nothing more until
+   tud_network_recv_renew(): ECM/RNDIS one frame, NCM all datagrams of one NTB. The buffer is
+   renewed once the last pbuf over it is freed, so a slot per datagram of the held buffer suffices. */
+#if CFG_TUD_NCM
+#define RX_ZC_SLOTS CFG_TUD_NCM_OUT_DATAGRAM_TABLE_N
+#else
+#define RX_ZC_SLOTS 1
+#endif
+
+typedef struct {
+    struct pbuf_custom pc;  /* must be first: lwIP hands back the pbuf pointer */
+    recv_arg_t ra;
+} rx_zc_slot_t;
+
+static rx_zc_slot_t s_rx_zc_slots[RX_ZC_SLOTS];
+static atomic_uint s_rx_zc_refs; /* pbufs alive over the held USB buffer */
+
+/* Runs in TinyUSB task: give the RX buffer back to the driver */
+static void rx_zc_renew_deferred(void *arg)
+{
+    (void)arg;
+    tud_network_recv_renew();
+}
+
+/* pbuf_custom free hook: called by whichever thread drops the last pbuf reference */
+static void rx_zc_pbuf_free(struct pbuf *p)
+{
+    (void)p;
+    if (atomic_fetch_sub(&s_rx_zc_refs, 1) == 1) {
+        usbd_defer_func(rx_zc_renew_deferred, NULL, false);
+    }
+}
+
+/* Wrap a received frame into slot i without copying; the reference is taken on success only */
+static struct pbuf *rx_zc_wrap(unsigned i, const uint8_t *src, uint16_t size)
+{
+    rx_zc_slot_t *slot = &s_rx_zc_slots[i];
+    slot->pc.custom_free_function = rx_zc_pbuf_free;
+    struct pbuf *p = pbuf_alloced_custom(PBUF_RAW, size, PBUF_REF, &slot->pc, (void*)src, size);
+    if (p) atomic_fetch_add(&s_rx_zc_refs, 1);
+    return p;
+}
+
+#endif /* CONFIG_DONGLE_USB_RX_ZERO_COPY */
+
+/* RX drop accounting (read from any task, updated by the TinyUSB task) */
+static atomic_uint s_rx_drop_pool_empty; /* no handoff descriptor (or zero-copy slot) available */
+static atomic_uint s_rx_drop_pbuf_empty; /* pbuf allocation failed */
+static atomic_uint s_rx_drop_ring_full;  /* handoff ring to the tcpip thread full */
+
+#if !CONFIG_DONGLE_USB_RX_ZERO_COPY
+/* Copy RX: handoff descriptors come from a static pool instead of the heap. Free descriptors form
+   a lock-free LIFO linked by index. The list head packs a generation tag in the upper 16 bits so a
+   concurrent pop/push pair cannot be mistaken for an unchanged head (ABA). */
+#define RX_POOL_SIZE CONFIG_DONGLE_USB_RX_POOL_SIZE
+#define RX_POOL_NIL  0xFFFFu
+_Static_assert(RX_POOL_SIZE < RX_POOL_NIL, "CONFIG_DONGLE_USB_RX_POOL_SIZE too large");
+
+static recv_arg_t s_rx_pool[RX_POOL_SIZE];
+static uint16_t s_rx_pool_next[RX_POOL_SIZE];
+static atomic_uint s_rx_pool_head;
+
+static void rx_pool_init(void)
+{
+    for (unsigned i = 0; i < RX_POOL_SIZE; ++i) {
+        s_rx_pool_next[i] = (i + 1 < RX_POOL_SIZE) ? (uint16_t)(i + 1) : RX_POOL_NIL;
+    }
+    atomic_store(&s_rx_pool_head, 0);
+}
+
+static recv_arg_t *rx_pool_get(void)
+{
+    unsigned head = atomic_load_explicit(&s_rx_pool_head, memory_order_acquire);
+    for (;;) {
+        unsigned idx = head & 0xFFFFu;
+        if (idx == RX_POOL_NIL) return NULL;
+        unsigned next = ((head + 0x10000u) & 0xFFFF0000u) | s_rx_pool_next[idx];
+        if (atomic_compare_exchange_weak_explicit(&s_rx_pool_head, &head, next,
+                                                  memory_order_acquire, memory_order_acquire)) {
+            return &s_rx_pool[idx];
+        }
+    }
+}
+
+static void rx_pool_put(recv_arg_t *ra)
+{
+    unsigned idx = (unsigned)(ra - s_rx_pool);
+    unsigned head = atomic_load_explicit(&s_rx_pool_head, memory_order_relaxed);
+    for (;;) {
+        s_rx_pool_next[idx] = (uint16_t)(head & 0xFFFFu);
+        unsigned next = ((head + 0x10000u) & 0xFFFF0000u) | idx;
+        if (atomic_compare_exchange_weak_explicit(&s_rx_pool_head, &head, next,
+                                                  memory_order_release, memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+#endif /* !CONFIG_DONGLE_USB_RX_ZERO_COPY */
+
+/* Release a handoff descriptor obtained in tud_network_recv_cb */
+static void rx_arg_release(recv_arg_t *ra)
+{
+#if CONFIG_DONGLE_USB_RX_ZERO_COPY
+    (void)ra; /* embedded in the zero-copy slot, released by rx_zc_pbuf_free */
+#else
+    rx_pool_put(ra);
+#endif
+}
+
+/* Log RX drop counters if any of them moved since the last call */
+static void rx_log_drop_stats(void)
+{
+    static unsigned last_pool, last_pbuf, last_ring;
+    unsigned pool = atomic_load(&s_rx_drop_pool_empty);
+    unsigned pbuf = atomic_load(&s_rx_drop_pbuf_empty);
+    unsigned ring = atomic_load(&s_rx_drop_ring_full);
+    if (pool == last_pool && pbuf == last_pbuf && ring == last_ring) return;
+    ESP_LOGW(TAG, "USB RX drops: pool-empty=%u pbuf-empty=%u ring-full=%u", pool, pbuf, ring);
+    last_pool = pool;
+    last_pbuf = pbuf;
+    last_ring = ring;
+}
+
+#if CFG_TUD_NCM
+/* NTBs the NCM driver threw away, by reason */
+static void ncm_rx_log_stats(void)
+{
+    static tud_ncm_recv_stats_t last;
+    tud_ncm_recv_stats_t st;
+    tud_network_ncm_recv_stats(&st);
+    if (st.drop_nth == last.drop_nth && st.drop_ndp == last.drop_ndp &&
+        st.drop_ndp_chain == last.drop_ndp_chain && st.drop_datagram == last.drop_datagram &&
+        st.drop_table_full == last.drop_table_full && st.drop_crc == last.drop_crc) {
+        return;
+    }
+    ESP_LOGW(TAG, "NCM RX NTB drops: nth=%" PRIu32 " ndp=%" PRIu32 " ndp-chain=%" PRIu32
+             " datagram=%" PRIu32 " table-full=%" PRIu32 ", bad-crc frames=%" PRIu32
+             " (accepted %" PRIu32 " NTBs, %" PRIu32 " frames)",
+             st.drop_nth, st.drop_ndp, st.drop_ndp_chain, st.drop_datagram, st.drop_table_full,
+             st.drop_crc, st.ntbs, st.datagrams);
+    last = st;
+}
+#endif
+
+#if CFG_TUD_ECM_RNDIS
+/* frames the ECM/RNDIS driver did not pass on, by direction and reason */
+static void ecm_rndis_log_stats(void)
+{
+    static tud_ecm_rndis_stats_t last;
+    tud_ecm_rndis_stats_t st;
+    tud_network_ecm_rndis_stats(&st);
+    if (st.xmit.drop_filter == last.xmit.drop_filter && st.xmit.drop_no_buffer == last.xmit.drop_no_buffer &&
+        st.recv.drop_no_buffer == last.recv.drop_no_buffer && st.recv.errors == last.recv.errors) {
+        return;
+    }
+    ESP_LOGW(TAG, "USB TX drops: host filter=%" PRIu32 " no-buffer=%" PRIu32 " (sent %" PRIu32
+             " frames, %" PRIu32 " multicast, %" PRIu32 " broadcast); USB RX drops: refused=%" PRIu32
+             " malformed=%" PRIu32 " (accepted %" PRIu32 " frames)",
+             st.xmit.drop_filter, st.xmit.drop_no_buffer, st.xmit.frames, st.xmit.multicast_frames,
+             st.xmit.broadcast_frames, st.recv.drop_no_buffer, st.recv.errors, st.recv.frames);
+    last = st;
+}
+#endif
+
+#if CFG_TUD_NCM_CRC
+/* NCM CRC mode: FCS of every datagram in both directions, slicing-by-8 instead of the driver's
+   bit-wise default */
+uint32_t tud_network_ncm_crc32_cb(uint32_t crc, const uint8_t *data, uint16_t len)
+{
+    return net_crc32(crc, data, len);
+}
+#endif
+
 /* Dump lwIP netif diagnostic info */
 static void dump_lwip_netif_info(struct netif *n)
 {
@@ -126,34 +343,130 @@ static struct netif* wait_for_lwip_netif_ready(esp_netif_t *enet, int timeout_ms
     return NULL;
 }
 
-/* Runs in tcpip thread: hand pbuf to lwIP netif input */
-static void netif_input_cb(void *arg)
+/* ---------------- RX batching (TinyUSB task -> tcpip thread) ---------------- */
+/* Received frames are queued in a single-producer (TinyUSB task) / single-consumer (tcpip thread)
+   ring. One tcpip callback drains up to CONFIG_DONGLE_USB_RX_BATCH_MAX frames per run and is only
+   posted when the ring goes from empty to non-empty, instead of one mailbox post per frame. */
+#define RX_RING_SIZE CONFIG_DONGLE_USB_RX_RING_SIZE
+#define RX_RING_MASK (RX_RING_SIZE - 1)
+_Static_assert((RX_RING_SIZE & RX_RING_MASK) == 0, "CONFIG_DONGLE_USB_RX_RING_SIZE must be a power of two");
+
+static recv_arg_t *s_rx_ring[RX_RING_SIZE];
+static atomic_uint s_rx_head;        /* written by the producer only */
+static atomic_uint s_rx_tail;        /* written by the consumer only */
+static atomic_bool s_rx_drain_armed; /* a drain callback is posted or running */
+
+static bool rx_ring_push(recv_arg_t *ra)
+{
+    unsigned head = atomic_load_explicit(&s_rx_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&s_rx_tail, memory_order_acquire);
+    if (head - tail >= RX_RING_SIZE) return false;
+    s_rx_ring[head & RX_RING_MASK] = ra;
+    atomic_store_explicit(&s_rx_head, head + 1, memory_order_release);
+    return true;
+}
+
+static recv_arg_t *rx_ring_pop(void)
+{
+    unsigned tail = atomic_load_explicit(&s_rx_tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&s_rx_head, memory_order_acquire);
+    if (tail == head) return NULL;
+    recv_arg_t *ra = s_rx_ring[tail & RX_RING_MASK];
+    atomic_store_explicit(&s_rx_tail, tail + 1, memory_order_release);
+    return ra;
+}
+
+/* Producer only, after arming a drain callback failed (still armed, so a finishing drain run
+   exits without popping): take the newest frame back unless that run already popped it. */
+static bool rx_ring_unpush(void)
+{
+    unsigned head = atomic_load_explicit(&s_rx_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&s_rx_tail, memory_order_acquire);
+    if (tail == head) return false;
+    atomic_store_explicit(&s_rx_head, head - 1, memory_order_release);
+    return true;
+}
+
+static bool rx_ring_empty(void)
 {
-    recv_arg_t *ra = (recv_arg_t*)arg;
-    if (!ra) return;
-    if (ra->n && ra->p) {
-        err_t res = ra->n->input(ra->p, ra->n);
-        if (res != ERR_OK) {
-            ESP_LOGW(TAG, "netif_input_cb: netif->input returned %d", res);
+    return atomic_load_explicit(&s_rx_head, memory_order_acquire) ==
+           atomic_load_explicit(&s_rx_tail, memory_order_acquire);
+}
+
+/* Runs in tcpip thread: hand up to one batch of frames to lwIP */
+static void rx_drain_batch(void)
+{
+    recv_arg_t *ra;
+    for (int i = 0; i < CONFIG_DONGLE_USB_RX_BATCH_MAX && (ra = rx_ring_pop()) != NULL; ++i) {
+        if (ra->n && ra->p) {
+#if CONFIG_DONGLE_TCP_MSS_CLAMP
+            mss_clamp_frame(ra->p->payload, ra->p->len, MSS_CLAMP_USB_TO_WIFI,
+                            ip4_addr_get_u32(netif_ip4_addr(ra->n)));
+#endif
+            /* Already in the tcpip thread: feed the Ethernet layer directly. netif->input of an
+               esp-netif interface is tcpip_input, which would post the frame to the mailbox again. */
+            err_t res = ethernet_input(ra->p, ra->n);
+            if (res != ERR_OK) {
+                ESP_LOGW(TAG, "rx_drain_batch: ethernet_input returned %d", res);
+                pbuf_free(ra->p);
+            }
+        } else if (ra->p) {
             pbuf_free(ra->p);
-        } else {
-            /* lwIP took ownership */
         }
-    } else {
-        if (ra->p) pbuf_free(ra->p);
+        rx_arg_release(ra);
     }
-    free(ra);
 }
 
-/* TinyUSB: called when backend attaches (link up). Start DHCP server (non-blocking). */
-static void usb_dhcps_start_task(void *arg)
+/* tcpip callback: drain the ring, then disarm (re-checking for frames pushed meanwhile) */
+static void rx_drain_cb(void *arg)
 {
-    esp_netif_t *enet = (esp_netif_t*)arg;
+    (void)arg;
+    for (;;) {
+        rx_drain_batch();
+        if (!rx_ring_empty()) {
+            /* batch budget used up: let other tcpip messages run, then continue */
+            if (tcpip_try_callback(rx_drain_cb, NULL) == ERR_OK) return;
+            continue; /* mailbox full, keep draining here */
+        }
+        atomic_store(&s_rx_drain_armed, false);
+        /* A frame pushed after the last pop saw the callback still armed and did not post */
+        if (rx_ring_empty() || atomic_exchange(&s_rx_drain_armed, true)) return;
+    }
+}
 
+/* Runs in TinyUSB task: queue a frame for the tcpip thread. On failure the caller still owns
+   both the descriptor and the pbuf. */
+static bool rx_enqueue(recv_arg_t *ra)
+{
+    if (!rx_ring_push(ra)) {
+        atomic_fetch_add(&s_rx_drop_ring_full, 1);
+        ESP_LOGD(TAG, "rx_enqueue: RX ring full, dropping frame");
+        return false;
+    }
+    /* arm the drain callback only on the empty -> non-empty transition */
+    if (!atomic_exchange(&s_rx_drain_armed, true)) {
+        if (tcpip_callback(rx_drain_cb, NULL) != ERR_OK) {
+            /* nothing would drain the ring until the next frame: take this one back and drop it,
+               unless the previous drain run already handed it to lwIP */
+            ESP_LOGW(TAG, "rx_enqueue: tcpip_callback failed");
+            bool taken_back = rx_ring_unpush();
+            atomic_store(&s_rx_drain_armed, false);
+            if (taken_back) {
+                atomic_fetch_add(&s_rx_drop_ring_full, 1);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Runs in usb_ip_task: bring up the USB address and DHCP server once the host attached */
+static void usb_dhcps_start(esp_netif_t *enet)
+{
     /* Wait longer for backend to become ready (some host stacks take time) */
     struct netif *lw = wait_for_lwip_netif_ready(enet, 5000);
     if (!lw) {
-        ESP_LOGW(TAG, "usb_dhcps_start_task: lwip backend not fully ready");
+        ESP_LOGW(TAG, "usb_dhcps_start: lwip backend not fully ready");
     }
 
     /* Prepare desired IP */
@@ -203,9 +516,9 @@ static void usb_dhcps_start_task(void *arg)
             IP4_ADDR(&nm, 255,255,255,0);
             IP4_ADDR(&gw, 192,168,42,1);
             netif_set_addr(lw, &ip4, &nm, &gw);
-            ESP_LOGI(TAG, "usb_dhcps_start_task: lwIP fallback set IP 192.168.42.1/24");
+            ESP_LOGI(TAG, "usb_dhcps_start: lwIP fallback set IP 192.168.42.1/24");
         } else {
-            ESP_LOGW(TAG, "usb_dhcps_start_task: cannot set lwIP fallback - no lwip netif");
+            ESP_LOGW(TAG, "usb_dhcps_start: cannot set lwIP fallback - no lwip netif");
         }
     }
 
@@ -229,12 +542,10 @@ static void usb_dhcps_start_task(void *arg)
     }
 
     if (rc != ESP_OK) {
-        ESP_LOGW(TAG, "usb_dhcps_start_task: dhcps_start failed permanently (%s). Host may need static IP.", esp_err_to_name(rc));
+        ESP_LOGW(TAG, "usb_dhcps_start: dhcps_start failed permanently (%s). Host may need static IP.", esp_err_to_name(rc));
     } else {
-        ESP_LOGI(TAG, "usb_dhcps_start_task: DHCP server started successfully");
+        ESP_LOGI(TAG, "usb_dhcps_start: DHCP server started successfully");
     }
-
-    vTaskDelete(NULL);
 }
 
 /* TinyUSB callback: network initialized */
@@ -245,33 +556,73 @@ void tud_network_init_cb(void)
         ESP_LOGW(TAG, "tud_network_init_cb: usb_netif NULL");
         return;
     }
-    /* create task to start DHCP non-blocking */
-    BaseType_t rc = xTaskCreate(usb_dhcps_start_task, "usb_dhcps", 4096, usb_netif, 5, NULL);
-    if (rc != pdPASS) {
-        ESP_LOGW(TAG, "tud_network_init_cb: failed to create usb_dhcps task");
-    } else {
-        ESP_LOGI(TAG, "tud_network_init_cb: usb_dhcps task created");
-    }
+    /* DHCP start blocks for a while: leave it to usb_ip_task */
+    if (s_app_events) xEventGroupSetBits(s_app_events, APP_EV_USB_NET_INIT);
 }
 
-/* Provide MAC to host */
-const uint8_t* tud_network_mac_address(void)
+/* Drop the frame offered to tud_network_recv_cb. ECM/RNDIS renews its RX buffer itself when the
+   callback returns false. NCM instead re-offers the datagram on the next renew, which nothing would
+   trigger once all NTBs are taken: consume it here so the rest of the NTB keeps flowing. */
+static bool rx_refuse(void)
 {
-    return s_usb_mac;
+#if CFG_TUD_NCM
+    tud_network_recv_renew();
+    return true;
+#else
+    return false;
+#endif
 }
 
-/* TinyUSB -> device: schedule incoming frame into tcpip thread */
-bool tud_network_recv_cb(const uint8_t *src, uint16_t size)
+/* Frames the forwarding fast path sends to WiFi itself: the USB buffer is free again on return */
+static bool rx_forward_direct(const uint8_t *src, uint16_t size)
 {
-    if (!src || size == 0) return false;
-    if (!usb_netif) return false;
-
-    struct netif *lw = esp_netif_get_netif_impl(usb_netif);
-    if (!lw) return false;
+#if CONFIG_DONGLE_FORWARD_L2_BRIDGE
+    return l2_bridge_from_usb(src, size);
+#elif CONFIG_DONGLE_NAPT_FASTPATH
+    return napt_fastpath_from_usb(src, size);
+#else
+    (void)src;
+    (void)size;
+    return false;
+#endif
+}
 
+#if CONFIG_DONGLE_USB_RX_ZERO_COPY
+/* Wrap and queue one frame of the held buffer. Returns false (drop counted) if it could not be
+   wrapped; a frame the ring refuses is freed right away, which may schedule the renew. */
+static bool rx_zc_frame(unsigned i, struct netif *lw, const uint8_t *src, uint16_t size)
+{
+    struct pbuf *p = rx_zc_wrap(i, src, size);
+    if (!p) {
+        atomic_fetch_add(&s_rx_drop_pbuf_empty, 1);
+        ESP_LOGD(TAG, "rx_zc_frame: pbuf_alloced_custom failed, dropping %u bytes", size);
+        return false;
+    }
+    recv_arg_t *ra = &s_rx_zc_slots[i].ra;
+    ra->p = p;
+    ra->n = lw;
+    if (!rx_enqueue(ra)) {
+        pbuf_free(p);
+    }
+    return true;
+}
+#else
+/* Copy a frame into a pbuf and queue it for the tcpip thread. Returns false (drop counted) if
+   no descriptor, pbuf or ring slot was available. */
+static bool rx_copy_frame(struct netif *lw, const uint8_t *src, uint16_t size)
+{
+    /* take the descriptor first: it cannot fail halfway through a copy */
+    recv_arg_t *ra = rx_pool_get();
+    if (!ra) {
+        atomic_fetch_add(&s_rx_drop_pool_empty, 1);
+        ESP_LOGD(TAG, "rx_copy_frame: descriptor pool empty, dropping %u bytes", size);
+        return false;
+    }
     struct pbuf *p = pbuf_alloc(PBUF_RAW, size, PBUF_POOL);
     if (!p) {
-        ESP_LOGW(TAG, "tud_network_recv_cb: pbuf_alloc failed for size %u", size);
+        rx_pool_put(ra);
+        atomic_fetch_add(&s_rx_drop_pbuf_empty, 1);
+        ESP_LOGD(TAG, "rx_copy_frame: pbuf_alloc failed for size %u", size);
         return false;
     }
 
@@ -282,36 +633,81 @@ bool tud_network_recv_cb(const uint8_t *src, uint16_t size)
         memcpy(q->payload, src + copied, c);
         copied += c;
     }
-
-    recv_arg_t *ra = malloc(sizeof(*ra));
-    if (!ra) { pbuf_free(p); return false; }
     ra->p = p;
     ra->n = lw;
 
-    /* post to tcpip thread safely */
-#if defined(tcpip_callback_with_block)
-    if (tcpip_callback_with_block(netif_input_cb, ra, 0) != ERR_OK) {
-        ESP_LOGW(TAG, "tud_network_recv_cb: tcpip_callback_with_block failed");
-        pbuf_free(p); free(ra); return false;
-    }
-#elif defined(tcpip_callback)
-    if (tcpip_callback(netif_input_cb, ra) != ERR_OK) {
-        ESP_LOGW(TAG, "tud_network_recv_cb: tcpip_callback failed");
-        pbuf_free(p); free(ra); return false;
-    }
-#else
-    /* fallback: direct call (less safe) */
-    err_t r = lw->input(p, lw);
-    if (r != ERR_OK) {
+    if (!rx_enqueue(ra)) {
+        rx_arg_release(ra);
         pbuf_free(p);
-        free(ra);
         return false;
     }
-    free(ra);
+    return true;
+}
 #endif
 
+/* TinyUSB -> device: queue incoming frame for the tcpip thread (ECM/RNDIS; NCM delivers whole
+   NTBs through tud_network_recv_batch_cb) */
+bool tud_network_recv_cb(const uint8_t *src, uint16_t size)
+{
+    if (!src || size == 0) return rx_refuse();
+    if (!usb_netif) return rx_refuse();
+
+    struct netif *lw = esp_netif_get_netif_impl(usb_netif);
+    if (!lw) return rx_refuse();
+
+    if (rx_forward_direct(src, size)) {
+        tud_network_recv_renew();
+        return true;
+    }
+
+#if CONFIG_DONGLE_USB_RX_ZERO_COPY
+    if (atomic_load(&s_rx_zc_refs) != 0) {
+        atomic_fetch_add(&s_rx_drop_pool_empty, 1);
+        ESP_LOGD(TAG, "tud_network_recv_cb: zero-copy slot busy, dropping %u bytes", size);
+        return false;
+    }
+    /* a frame the ring refuses is freed right away: that schedules the buffer renew */
+    return rx_zc_frame(0, lw, src, size);
+#else
+    if (!rx_copy_frame(lw, src, size)) return rx_refuse();
+
+    /* frame copied out: the USB buffer can take the next one */
+    tud_network_recv_renew();
     return true;
+#endif
+}
+
+#if CFG_TUD_NCM
+/* NCM: all datagrams of an NTB in one call. Each frame is forwarded, copied out or wrapped in place
+   (or dropped and counted), so the whole batch is consumed; the renew releases the NTB and, from
+   within this call, delivers the next one. The frames of an NTB thus reach the RX ring with a single
+   tcpip wakeup. Zero-copy holds the NTB until lwIP has freed every pbuf over it. */
+uint16_t tud_network_recv_batch_cb(const tud_network_datagram_t *datagrams, uint16_t count)
+{
+    struct netif *lw = usb_netif ? esp_netif_get_netif_impl(usb_netif) : NULL;
+
+#if CONFIG_DONGLE_USB_RX_ZERO_COPY
+    /* own reference while wrapping: a pbuf freed early must not renew the NTB under the loop */
+    atomic_store(&s_rx_zc_refs, 1);
+#endif
+    for (uint16_t i = 0; i < count; ++i) {
+        const uint8_t *src = datagrams[i].data;
+        uint16_t size = datagrams[i].length;
+        if (!lw || !src || size == 0) continue;
+        if (rx_forward_direct(src, size)) continue;
+#if CONFIG_DONGLE_USB_RX_ZERO_COPY
+        rx_zc_frame(i, lw, src, size);
+#else
+        rx_copy_frame(lw, src, size);
+#endif
+    }
+#if CONFIG_DONGLE_USB_RX_ZERO_COPY
+    if (atomic_fetch_sub(&s_rx_zc_refs, 1) != 1) return count; /* the last pbuf free renews */
+#endif
+    tud_network_recv_renew();
+    return count;
 }
+#endif
 
 /* TinyUSB expects a copy-style xmit callback in some wrappers; implement safe copy */
 uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg)
@@ -330,26 +726,289 @@ uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg)
     return total;
 }
 
+#if CFG_TUD_NCM_XMIT_SG
+/* NCM by-reference transmit: the class driver streams the pbuf payloads to the endpoint and hands the
+   reference back once the NTB is sent; chains longer than max fall back to tud_network_xmit_cb */
+uint8_t tud_network_xmit_sg_cb(void *ref, uint16_t arg, tud_network_datagram_t *segs, uint8_t max)
+{
+    (void)arg;
+    uint8_t n = 0;
+    for (struct pbuf *q = (struct pbuf *)ref; q; q = q->next) {
+        if (!q->len) continue;
+        if (n == max) return 0;
+        segs[n].data = q->payload;
+        segs[n].length = q->len;
+        n++;
+    }
+    return n;
+}
+
+void tud_network_xmit_sg_release_cb(void *ref)
+{
+    pbuf_free((struct pbuf *)ref);
+}
+#endif
+
 /* ---------------- esp-netif driver glue (usb transmit/free rx) ---------------- */
-/* Many esp-netif drivers expect transmit() to consume a pbuf pointer (driver-owned).
-   We call tud_network_xmit(p, 0) which some TinyUSB wrappers implement. */
-static esp_err_t usb_driver_transmit(void *handle, void *buffer, size_t len)
+/* Downlink frames are not handed to TinyUSB from the tcpip thread. usb_driver_transmit_wrap takes a
+   pbuf reference and queues it in a bounded backlog; the TinyUSB task drains the backlog while
+   tud_network_can_xmit() allows, and again from tud_network_xmit_done_cb() whenever the class driver
+   releases a transmit buffer. The reference is dropped by tud_network_xmit_cb after the copy (with
+   CFG_TUD_NCM_XMIT_SG by tud_network_xmit_sg_release_cb once the NTB is sent), or when the frame is
+   discarded. */
+#define TX_BACKLOG_DEPTH CONFIG_DONGLE_USB_TX_BACKLOG_DEPTH
+
+static struct pbuf *s_tx_backlog[TX_BACKLOG_DEPTH];
+static unsigned s_tx_head;  /* next to send */
+static unsigned s_tx_count;
+static portMUX_TYPE s_tx_lock = portMUX_INITIALIZER_UNLOCKED;
+static atomic_bool s_tx_drain_scheduled;
+static atomic_uint s_tx_drop_backlog_full;
+static atomic_uint s_tx_drop_not_ready;
+static atomic_uint s_tx_drop_host_filter;
+
+/* Queue a referenced pbuf. Returns the pbuf that has to be released (overflow victim) or NULL. */
+static struct pbuf *tx_backlog_push(struct pbuf *p)
 {
-    (void)handle; (void)len;
-    struct pbuf *p = (struct pbuf*)buffer;
-    if (!p) return ESP_ERR_INVALID_ARG;
+    struct pbuf *victim = NULL;
+    taskENTER_CRITICAL(&s_tx_lock);
+    if (s_tx_count == TX_BACKLOG_DEPTH) {
+#if CONFIG_DONGLE_USB_TX_DROP_HEAD
+        /* drop the oldest frame: the newest data is usually the most useful (e.g. TCP retransmits) */
+        victim = s_tx_backlog[s_tx_head];
+        s_tx_head = (s_tx_head + 1) % TX_BACKLOG_DEPTH;
+        s_tx_count--;
+#else
+        victim = p;
+#endif
+    }
+    if (victim != p) {
+        s_tx_backlog[(s_tx_head + s_tx_count) % TX_BACKLOG_DEPTH] = p;
+        s_tx_count++;
+    }
+    taskEXIT_CRITICAL(&s_tx_lock);
+    return victim;
+}
+
+/* Peek at the oldest queued frame length; 0 when empty */
+static uint16_t tx_backlog_peek_len(void)
+{
+    uint16_t len = 0;
+    taskENTER_CRITICAL(&s_tx_lock);
+    if (s_tx_count) len = s_tx_backlog[s_tx_head]->tot_len;
+    taskEXIT_CRITICAL(&s_tx_lock);
+    return len;
+}
+
+static struct pbuf *tx_backlog_pop(void)
+{
+    struct pbuf *p = NULL;
+    taskENTER_CRITICAL(&s_tx_lock);
+    if (s_tx_count) {
+        p = s_tx_backlog[s_tx_head];
+        s_tx_head = (s_tx_head + 1) % TX_BACKLOG_DEPTH;
+        s_tx_count--;
+    }
+    taskEXIT_CRITICAL(&s_tx_lock);
+    return p;
+}
+
+#if CFG_TUD_NCM && CONFIG_DONGLE_NCM_TX_HOLDOFF_US > 0
+/* NCM downlink aggregation: while frames arrive back to back, a partially filled NTB is kept back
+   (tud_network_ncm_xmit_holdoff_cb) until it reaches the byte/frame threshold, the backlog drain
+   has appended everything queued, or the hold-off timer runs out. The arrival gap is measured where
+   frames enter the backlog, so it reflects the offered load rather than the drain loop. */
+static esp_timer_handle_t s_ncm_holdoff_timer;
+static atomic_bool s_ncm_holdoff_armed;
+static atomic_uint s_ncm_tx_last_arrival_us;
+static atomic_uint s_ncm_tx_arrival_gap_us = UINT32_MAX;
+static atomic_uint s_ncm_tx_held;        /* NTBs kept back for the hold-off time */
+static atomic_uint s_ncm_tx_timer_flush; /* ... and sent when the timer expired */
+
+static void ncm_tx_note_arrival(void)
+{
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    uint32_t prev = atomic_exchange(&s_ncm_tx_last_arrival_us, now);
+    atomic_store(&s_ncm_tx_arrival_gap_us, now - prev);
+}
+
+static void ncm_holdoff_expired(void *arg)
+{
+    (void)arg;
+    if (!atomic_exchange(&s_ncm_holdoff_armed, false)) return; /* flushed in the meantime */
+    atomic_fetch_add(&s_ncm_tx_timer_flush, 1);
+    tud_network_ncm_xmit_flush();
+}
 
+/* esp_timer task: the flush has to run in TinyUSB task context */
+static void ncm_holdoff_timer_cb(void *arg)
+{
+    (void)arg;
+    usbd_defer_func(ncm_holdoff_expired, NULL, false);
+}
+
+/* TinyUSB: a datagram was appended to the current NTB, return true to keep it back */
+bool tud_network_ncm_xmit_holdoff_cb(uint16_t datagrams, uint16_t ntb_len)
+{
+    if (datagrams >= CONFIG_DONGLE_NCM_TX_HOLDOFF_DATAGRAMS || ntb_len >= CONFIG_DONGLE_NCM_TX_HOLDOFF_BYTES) {
+        if (atomic_exchange(&s_ncm_holdoff_armed, false)) esp_timer_stop(s_ncm_holdoff_timer);
+        return false;
+    }
+    /* more frames are queued: tx_backlog_drain appends them and flushes at the end */
+    if (tx_backlog_peek_len() != 0) return true;
+    if (atomic_load(&s_ncm_holdoff_armed)) return true;
+    /* idle link: do not delay a lone frame */
+    if (atomic_load(&s_ncm_tx_arrival_gap_us) > CONFIG_DONGLE_NCM_TX_HOLDOFF_US) return false;
+
+    atomic_store(&s_ncm_holdoff_armed, true);
+    if (esp_timer_start_once(s_ncm_holdoff_timer, CONFIG_DONGLE_NCM_TX_HOLDOFF_US) != ESP_OK) {
+        atomic_store(&s_ncm_holdoff_armed, false);
+        return false;
+    }
+    atomic_fetch_add(&s_ncm_tx_held, 1);
+    return true;
+}
+
+static void ncm_tx_log_stats(void)
+{
+    static unsigned last_held, last_timer;
+    unsigned held = atomic_load(&s_ncm_tx_held);
+    unsigned timer = atomic_load(&s_ncm_tx_timer_flush);
+    if (held == last_held && timer == last_timer) return;
+    ESP_LOGI(TAG, "NCM TX hold-off: held=%u timer-flushed=%u", held, timer);
+    last_held = held;
+    last_timer = timer;
+}
+#endif /* CFG_TUD_NCM && CONFIG_DONGLE_NCM_TX_HOLDOFF_US > 0 */
+
+/* Runs in TinyUSB task: send queued frames while the class driver has room */
+static void tx_backlog_drain(void)
+{
     if (!tud_ready()) {
-        ESP_LOGW(TAG, "usb_driver_transmit: TinyUSB not ready, dropping");
+        /* host gone: nothing will ever complete, release everything */
+        struct pbuf *p;
+        while ((p = tx_backlog_pop()) != NULL) {
+            atomic_fetch_add(&s_tx_drop_not_ready, 1);
+            pbuf_free(p);
+        }
+        return;
+    }
+    uint16_t len;
+    while ((len = tx_backlog_peek_len()) != 0 && tud_network_can_xmit(len)) {
+        /* head may have been replaced by a head-drop in between; tot_len is only a hint for NCM */
+        struct pbuf *p = tx_backlog_pop();
+        if (!p) break;
+        tud_network_xmit(p, 0); /* tud_network_xmit_cb copies and releases p */
+    }
+#if CFG_TUD_NCM && CONFIG_DONGLE_NCM_TX_HOLDOFF_US > 0
+    /* frames kept back only because more were queued go out now; a running hold-off timer
+       (or a full NTB / completed transfer) takes care of the rest */
+    if (!atomic_load(&s_ncm_holdoff_armed)) tud_network_ncm_xmit_flush();
+#endif
+}
+
+static void tx_drain_deferred(void *arg)
+{
+    (void)arg;
+    atomic_store(&s_tx_drain_scheduled, false);
+    tx_backlog_drain();
+}
+
+/* TinyUSB: a transmit buffer became free (called from netd_xfer_cb, TinyUSB task) */
+void tud_network_xmit_done_cb(void)
+{
+    tx_backlog_drain();
+}
+
+/* Log TX drop counters if any of them moved since the last call */
+static void tx_log_drop_stats(void)
+{
+    static unsigned last_full, last_not_ready, last_filter;
+    unsigned full = atomic_load(&s_tx_drop_backlog_full);
+    unsigned not_ready = atomic_load(&s_tx_drop_not_ready);
+    unsigned filter = atomic_load(&s_tx_drop_host_filter);
+    if (full == last_full && not_ready == last_not_ready && filter == last_filter) return;
+    ESP_LOGW(TAG, "USB TX drops: backlog-full=%u not-ready=%u host-filter=%u", full, not_ready, filter);
+    last_full = full;
+    last_not_ready = not_ready;
+    last_filter = filter;
+}
+
+/* Queue a frame for the host and kick the TinyUSB task. Takes over one reference to p.
+   Frames the host's packet/multicast filter does not select (e.g. WLAN multicast floods) are dropped
+   here, so they neither take a backlog slot nor USB bandwidth. */
+static esp_err_t usb_tx_queue(struct pbuf *p)
+{
+    if (p->len >= 6 && !tud_network_filter_accepts((const uint8_t *)p->payload)) {
+        atomic_fetch_add(&s_tx_drop_host_filter, 1);
         pbuf_free(p);
-        return ESP_FAIL;
+        return ESP_OK;
+    }
+#if CFG_TUD_NCM && CONFIG_DONGLE_NCM_TX_HOLDOFF_US > 0
+    ncm_tx_note_arrival();
+#endif
+    struct pbuf *victim = tx_backlog_push(p);
+    if (victim) {
+        atomic_fetch_add(&s_tx_drop_backlog_full, 1);
+        pbuf_free(victim);
+        if (victim == p) return ESP_ERR_NO_MEM;
     }
 
-    /* Call wrapper function to send to host. This hands pbuf to TinyUSB wrapper (it must copy/free). */
-    tud_network_xmit(p, 0);
+    if (!atomic_exchange(&s_tx_drain_scheduled, true)) {
+        usbd_defer_func(tx_drain_deferred, NULL, false);
+    }
     return ESP_OK;
 }
 
+/* esp-netif transmit_wrap: called by the lwIP glue (tcpip thread or core-lock holder) with the
+   frame payload and the owning pbuf in netstack_buf. lwIP frees its pbuf on return, so keep a
+   reference of our own until the frame has been copied into the USB buffer. */
+static esp_err_t usb_driver_transmit_wrap(void *handle, void *buffer, size_t len, void *netstack_buf)
+{
+    (void)handle; (void)buffer; (void)len;
+    struct pbuf *p = (struct pbuf*)netstack_buf;
+    if (!p) return ESP_ERR_INVALID_ARG;
+
+    if (!tud_ready()) {
+        atomic_fetch_add(&s_tx_drop_not_ready, 1);
+        return ESP_FAIL;
+    }
+
+    bool copy = (p->type_internal & PBUF_TYPE_FLAG_DATA_VOLATILE) != 0;
+#if CONFIG_DONGLE_TCP_MSS_CLAMP
+    /* Forwarded SYNs only: lwIP may still hold this pbuf (e.g. on a TCP unacked queue), so the
+       rewrite goes to a private copy */
+    struct netif *lw = esp_netif_get_netif_impl(usb_netif);
+    uint32_t local_ip = lw ? ip4_addr_get_u32(netif_ip4_addr(lw)) : 0;
+    bool clamp = mss_clamp_needed(p->payload, p->len, MSS_CLAMP_WIFI_TO_USB, local_ip);
+    copy = copy || clamp;
+#endif
+    if (copy) {
+        /* PBUF_REF payload may not outlive this call: queue a private copy instead */
+        p = pbuf_clone(PBUF_RAW, PBUF_RAM, p);
+        if (!p) return ESP_ERR_NO_MEM;
+    } else {
+        pbuf_ref(p);
+    }
+#if CONFIG_DONGLE_TCP_MSS_CLAMP
+    if (clamp) mss_clamp_frame(p->payload, p->len, MSS_CLAMP_WIFI_TO_USB, local_ip);
+#endif
+    return usb_tx_queue(p);
+}
+
+/* esp-netif requires a plain transmit hook too; it is only used when no pbuf is at hand */
+static esp_err_t usb_driver_transmit(void *handle, void *buffer, size_t len)
+{
+    (void)handle;
+    if (!buffer || len == 0 || len > 0xFFFF) return ESP_ERR_INVALID_ARG;
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, (uint16_t)len, PBUF_RAM);
+    if (!p) return ESP_ERR_NO_MEM;
+    memcpy(p->payload, buffer, len);
+    esp_err_t rc = usb_driver_transmit_wrap(handle, p->payload, len, p);
+    pbuf_free(p);
+    return rc;
+}
+
 /* free rx buffer callback (esp-netif) */
 static void usb_driver_free_rx_buffer(void *handle, void *buffer)
 {
@@ -362,7 +1021,7 @@ static void usb_driver_free_rx_buffer(void *handle, void *buffer)
 static const esp_netif_driver_ifconfig_t s_usb_driver_ifconfig = {
     .handle = NULL,
     .transmit = usb_driver_transmit,
-    .transmit_wrap = NULL,
+    .transmit_wrap = usb_driver_transmit_wrap,
     .driver_free_rx_buffer = usb_driver_free_rx_buffer
 };
 
@@ -412,11 +1071,95 @@ static void ensure_usb_has_ip(esp_netif_t *enet, const char *ip_s, const char *m
     }
 }
 
+/* ---------------- data path topology (see Kconfig "Data path topology") ---------------- */
+#define TOPO_ANY_CORE (-1)
+#if CONFIG_DONGLE_TOPOLOGY_USB_CORE1
+#define TOPO_NAME       "USB+tcpip core 1, WiFi core 0"
+#define TOPO_USB_CORE   1
+#define TOPO_USB_PRIO   CONFIG_LWIP_TCPIP_TASK_PRIO
+#define TOPO_TCPIP_CORE 1
+#define TOPO_TCPIP_PRIO CONFIG_LWIP_TCPIP_TASK_PRIO
+#define TOPO_WIFI_CORE  0
+#elif CONFIG_DONGLE_TOPOLOGY_ALL_CORE0
+#define TOPO_NAME       "USB, tcpip and WiFi on core 0"
+#define TOPO_USB_CORE   0
+#define TOPO_USB_PRIO   (CONFIG_LWIP_TCPIP_TASK_PRIO - 1)
+#define TOPO_TCPIP_CORE 0
+#define TOPO_TCPIP_PRIO CONFIG_LWIP_TCPIP_TASK_PRIO
+#define TOPO_WIFI_CORE  0
+#else
+#define TOPO_NAME       "legacy"
+#define TOPO_USB_CORE   0
+#define TOPO_USB_PRIO   5
+#define TOPO_TCPIP_CORE TOPO_ANY_CORE
+#define TOPO_TCPIP_PRIO CONFIG_LWIP_TCPIP_TASK_PRIO
+#define TOPO_WIFI_CORE  TOPO_ANY_CORE
+#endif
+
+/* The tcpip thread and WiFi task affinities come from the LWIP and WiFi options: a preset they
+   contradict would silently not apply */
+#if CONFIG_DONGLE_TOPOLOGY_USB_CORE1 && !CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU1
+#error "Data path topology 'USB + tcpip on core 1' needs LWIP_TCPIP_TASK_AFFINITY_CPU1"
+#endif
+#if CONFIG_DONGLE_TOPOLOGY_ALL_CORE0 && !CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU0
+#error "Data path topology 'USB, tcpip and WiFi on core 0' needs LWIP_TCPIP_TASK_AFFINITY_CPU0"
+#endif
+#if (CONFIG_DONGLE_TOPOLOGY_USB_CORE1 || CONFIG_DONGLE_TOPOLOGY_ALL_CORE0) && !CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_0
+#error "Data path topology presets other than 'legacy' need ESP_WIFI_TASK_PINNED_TO_CORE_0"
+#endif
+
+/* The tcpip thread is created by esp_netif_init(); only its priority can change at runtime */
+static void topology_apply_tcpip(void)
+{
+    TaskHandle_t h = xTaskGetHandle(TCPIP_THREAD_NAME);
+    if (!h) {
+        ESP_LOGW(TAG, "topology: tcpip thread '%s' not found", TCPIP_THREAD_NAME);
+        return;
+    }
+    if (uxTaskPriorityGet(h) != TOPO_TCPIP_PRIO) {
+        vTaskPrioritySet(h, TOPO_TCPIP_PRIO);
+    }
+}
+
+/* Log one task's placement and compare it with the preset (want_core TOPO_ANY_CORE = don't care) */
+static void topology_check_task(const char *name, int want_core, int want_prio)
+{
+    TaskHandle_t h = xTaskGetHandle(name);
+    if (!h) {
+        ESP_LOGW(TAG, "topology: task '%s' not found", name);
+        return;
+    }
+    BaseType_t core = xTaskGetCoreID(h);
+    UBaseType_t prio = uxTaskPriorityGet(h);
+    bool ok = (want_core == TOPO_ANY_CORE || core == want_core) && (want_prio < 0 || (int)prio == want_prio);
+    if (ok) {
+        ESP_LOGI(TAG, "topology: %-8s core=%s prio=%u", name,
+                 core == tskNO_AFFINITY ? "any" : (core ? "1" : "0"), (unsigned)prio);
+    } else {
+        ESP_LOGW(TAG, "topology: %-8s core=%s prio=%u, preset wants core=%d prio=%d", name,
+                 core == tskNO_AFFINITY ? "any" : (core ? "1" : "0"), (unsigned)prio, want_core, want_prio);
+    }
+}
+
+/* Startup self-check: log where the data path tasks actually ended up */
+static void topology_self_check(void)
+{
+    ESP_LOGI(TAG, "topology: preset '%s'", TOPO_NAME);
+    topology_check_task("TinyUSB", TOPO_USB_CORE, TOPO_USB_PRIO);
+    /* tcpip thread also runs the RX ring drain (rx_drain_cb) */
+    topology_check_task(TCPIP_THREAD_NAME, TOPO_TCPIP_CORE, TOPO_TCPIP_PRIO);
+    topology_check_task("wifi", TOPO_WIFI_CORE, -1);
+}
+
 /* ---------------- TinyUSB install and create usb_netif ---------------- */
 static void tinyusb_init_and_create_usb_netif(void)
 {
     ESP_LOGI(TAG, "Installing TinyUSB driver (with custom descriptors & strings)");
 
+#if !CONFIG_DONGLE_USB_RX_ZERO_COPY
+    rx_pool_init(); /* before the driver can deliver frames */
+#endif
+
     /* prepare esp-netif config for ETH template */
     esp_netif_config_t netif_cfg = ESP_NETIF_DEFAULT_ETH();
     netif_cfg.driver = &s_usb_driver_ifconfig;
@@ -426,6 +1169,51 @@ static void tinyusb_init_and_create_usb_netif(void)
         ESP_LOGE(TAG, "Failed to create USB netif");
         return;
     }
+    /* no Ethernet driver fills in the MAC of this netif: give it the dongle's end of the link */
+    esp_err_t mrc = esp_netif_set_mac(usb_netif, s_usb_mac);
+    if (mrc != ESP_OK) {
+        ESP_LOGW(TAG, "esp_netif_set_mac(usb) returned %s", esp_err_to_name(mrc));
+    }
+
+#if CONFIG_DONGLE_FORWARD_L2_BRIDGE
+    esp_err_t brc = l2_bridge_init(sta_netif, usb_netif, usb_tx_queue);
+    if (brc != ESP_OK) {
+        ESP_LOGE(TAG, "l2_bridge_init failed: %s", esp_err_to_name(brc));
+    }
+#elif CONFIG_DONGLE_NAPT_FASTPATH
+    esp_err_t frc = napt_fastpath_init(sta_netif, usb_tx_queue);
+    if (frc != ESP_OK) {
+        ESP_LOGE(TAG, "napt_fastpath_init failed: %s", esp_err_to_name(frc));
+    }
+#endif
+
+    const uint8_t *hm = tud_network_mac_address;
+    snprintf(s_host_mac_str, sizeof(s_host_mac_str), "%02X%02X%02X%02X%02X%02X",
+             hm[0], hm[1], hm[2], hm[3], hm[4], hm[5]);
+
+#if CFG_TUD_NCM
+    const tud_ncm_config_t ncm_cfg = {
+        .ntb_in_max_size = CONFIG_DONGLE_NCM_NTB_IN_SIZE,
+        .ntb_out_max_size = CONFIG_DONGLE_NCM_NTB_OUT_SIZE,
+        .in_max_datagrams = CONFIG_DONGLE_NCM_IN_MAX_DATAGRAMS,
+        .out_max_datagrams = CONFIG_DONGLE_NCM_OUT_MAX_DATAGRAMS,
+    };
+    if (!tud_network_ncm_config(&ncm_cfg)) {
+        ESP_LOGW(TAG, "tud_network_ncm_config rejected NTB %d/%d bytes, %d/%d datagrams; using driver defaults",
+                 CONFIG_DONGLE_NCM_NTB_IN_SIZE, CONFIG_DONGLE_NCM_NTB_OUT_SIZE,
+                 CONFIG_DONGLE_NCM_IN_MAX_DATAGRAMS, CONFIG_DONGLE_NCM_OUT_MAX_DATAGRAMS);
+    }
+#if CONFIG_DONGLE_NCM_TX_HOLDOFF_US > 0
+    const esp_timer_create_args_t holdoff_args = {
+        .callback = ncm_holdoff_timer_cb,
+        .name = "ncm_holdoff",
+    };
+    if (esp_timer_create(&holdoff_args, &s_ncm_holdoff_timer) != ESP_OK) {
+        ESP_LOGE(TAG, "NCM hold-off timer creation failed");
+        return;
+    }
+#endif
+#endif
 
     tinyusb_config_t tusb_cfg;
     memset(&tusb_cfg, 0, sizeof(tusb_cfg));
@@ -434,8 +1222,8 @@ static void tinyusb_init_and_create_usb_netif(void)
     tusb_cfg.phy.self_powered = false;
     tusb_cfg.phy.vbus_monitor_io = -1;
     tusb_cfg.task.size = 4096;
-    tusb_cfg.task.priority = 5;
-    tusb_cfg.task.xCoreID = 0;
+    tusb_cfg.task.priority = TOPO_USB_PRIO;
+    tusb_cfg.task.xCoreID = TOPO_USB_CORE;
 
     tusb_cfg.descriptor.device = &desc_device;
     tusb_cfg.descriptor.qualifier = NULL;
@@ -447,6 +1235,9 @@ static void tinyusb_init_and_create_usb_netif(void)
     tusb_cfg.event_cb = NULL;
     tusb_cfg.event_arg = NULL;
 
+#if CFG_TUD_NCM_CRC
+    net_crc32_init(); /* tables before the host can select the CRC mode */
+#endif
     esp_err_t rc = tinyusb_driver_install(&tusb_cfg);
     if (rc != ESP_OK) {
         ESP_LOGE(TAG, "tinyusb_driver_install failed: %s (%d)", esp_err_to_name(rc), rc);
@@ -473,12 +1264,27 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
         ESP_LOGI(TAG, "WIFI_EVENT_STA_START -> connecting");
         esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+#if CONFIG_DONGLE_FORWARD_L2_BRIDGE
+        /* esp-netif's default handler (registered earlier, so run first) has just installed its
+           STA RX callback; put the bridge in front of it */
+        esp_err_t rc = l2_bridge_attach_wifi();
+        if (rc != ESP_OK) ESP_LOGW(TAG, "l2_bridge_attach_wifi returned %s", esp_err_to_name(rc));
+#elif CONFIG_DONGLE_NAPT_FASTPATH
+        /* same ordering argument as for the bridge: esp-netif's RX callback is installed by now */
+        esp_err_t rc = napt_fastpath_attach_wifi();
+        if (rc != ESP_OK) ESP_LOGW(TAG, "napt_fastpath_attach_wifi returned %s", esp_err_to_name(rc));
+#endif
+        xEventGroupSetBits(s_app_events, APP_EV_WIFI_CONNECTED);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
         wifi_event_sta_disconnected_t *d = (wifi_event_sta_disconnected_t*) event_data;
         int reason = d ? d->reason : -1;
         ESP_LOGW(TAG, "WIFI_EVENT_STA_DISCONNECTED (reason=%d) -> reconnecting", reason);
-        vTaskDelay(pdMS_TO_TICKS(500));
-        esp_wifi_connect();
+#if CONFIG_DONGLE_NAPT_FASTPATH
+        napt_fastpath_flush(); /* gateway MAC and STA address may change */
+#endif
+        /* don't stall the default event loop with the back-off delay */
+        xEventGroupSetBits(s_app_events, APP_EV_WIFI_DISCONNECTED);
     }
 }
 
@@ -503,6 +1309,11 @@ static void set_usb_ip_from_wifi(const esp_netif_ip_info_t *wifi_ipinfo)
 {
     if (!usb_netif || !wifi_ipinfo) return;
 
+#if CONFIG_DONGLE_NAPT_FASTPATH
+    /* cached translations carry the old STA address */
+    napt_fastpath_flush();
+#endif
+
     /* derive network from WiFi IP (assume IPv4) */
     uint32_t w = ntohl(wifi_ipinfo->ip.addr);
     uint8_t a = (w >> 24) & 0xFF;
@@ -586,8 +1397,144 @@ static void got_ip_handler(void* arg, esp_event_base_t event_base, int32_t event
     ip_event_got_ip_t *evt = (ip_event_got_ip_t*) event_data;
     ESP_LOGI(TAG, "WiFi got IP: " IPSTR, IP2STR(&evt->ip_info.ip));
 
-    enable_napt_on_sta();
-    set_usb_ip_from_wifi(&evt->ip_info);
+    taskENTER_CRITICAL(&s_wifi_ipinfo_lock);
+    s_wifi_ipinfo = evt->ip_info;
+    taskEXIT_CRITICAL(&s_wifi_ipinfo_lock);
+    xEventGroupSetBits(s_app_events, APP_EV_WIFI_GOT_IP);
+}
+
+#if CONFIG_DONGLE_USB_LINK_FOLLOWS_WIFI
+/* ---------------- WiFi link reported on USB ---------------- */
+/* Link state for the NCM/ECM notifications: written by the app loop, read in the TinyUSB task */
+static portMUX_TYPE s_usb_link_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_usb_link_connected;
+static uint32_t s_usb_link_bps;
+static bool s_usb_link_published;
+
+static void usb_link_publish_deferred(void *arg)
+{
+    (void)arg;
+    taskENTER_CRITICAL(&s_usb_link_lock);
+    bool connected = s_usb_link_connected;
+    uint32_t bps = s_usb_link_bps;
+    taskEXIT_CRITICAL(&s_usb_link_lock);
+    tud_network_link_state(connected, bps, bps);
+}
+
+/* Rate class of the association: top single-stream PHY rate of the negotiated mode, halved for
+   every 5 dB the RSSI is below -65 dBm (roughly where rate control starts stepping down), at most
+   down to 1/8. Coarse on purpose, so the host is not notified on every RSSI wobble. */
+static uint32_t wifi_rate_class_bps(const wifi_ap_record_t *ap)
+{
+    wifi_phy_mode_t mode;
+    if (esp_wifi_sta_get_negotiated_phymode(&mode) != ESP_OK) {
+        mode = ap->phy_11n ? WIFI_PHY_MODE_HT20 : ap->phy_11g ? WIFI_PHY_MODE_11G : WIFI_PHY_MODE_11B;
+    }
+    uint32_t top;
+    switch (mode) {
+    case WIFI_PHY_MODE_LR:   top = 500000; break;
+    case WIFI_PHY_MODE_11B:  top = 11000000; break;
+    case WIFI_PHY_MODE_HT20: top = 72200000; break;  /* MCS7, short GI */
+    case WIFI_PHY_MODE_HT40: top = 150000000; break; /* MCS7, short GI */
+    case WIFI_PHY_MODE_HE20: top = 143400000; break; /* MCS11 */
+    default:                 top = 54000000; break;  /* 11g/11a */
+    }
+    int shift = 0;
+    if (ap->rssi < -65) shift = (-65 - ap->rssi + 4) / 5;
+    if (shift > 3) shift = 3;
+    return top >> shift;
+}
+
+/* Re-read the association and notify the host if the state or the rate class changed */
+static void usb_link_update(void)
+{
+    wifi_ap_record_t ap;
+    bool connected = (esp_wifi_sta_get_ap_info(&ap) == ESP_OK);
+    /* keep the last rate while disconnected, only the carrier changes */
+    uint32_t bps = connected ? wifi_rate_class_bps(&ap) : s_usb_link_bps;
+    if (s_usb_link_published && connected == s_usb_link_connected && bps == s_usb_link_bps) return;
+
+    taskENTER_CRITICAL(&s_usb_link_lock);
+    s_usb_link_connected = connected;
+    s_usb_link_bps = bps;
+    taskEXIT_CRITICAL(&s_usb_link_lock);
+    s_usb_link_published = true;
+    ESP_LOGI(TAG, "USB link: WiFi %s, %" PRIu32 " kbit/s", connected ? "connected" : "disconnected",
+             bps / 1000);
+    if (tud_inited()) usbd_defer_func(usb_link_publish_deferred, NULL, false);
+}
+#endif
+
+#if !CONFIG_DONGLE_FORWARD_L2_BRIDGE
+/* USB address / DHCP server jobs, one at a time in event order; bits set meanwhile run next */
+static void usb_ip_task(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        EventBits_t bits = xEventGroupWaitBits(s_app_events, APP_EV_USB_IP, pdTRUE, pdFALSE, portMAX_DELAY);
+        if (bits & APP_EV_USB_NET_INIT) {
+            if (usb_netif) usb_dhcps_start(usb_netif);
+        }
+        if (bits & APP_EV_WIFI_GOT_IP) {
+            esp_netif_ip_info_t ipinfo;
+            taskENTER_CRITICAL(&s_wifi_ipinfo_lock);
+            ipinfo = s_wifi_ipinfo;
+            taskEXIT_CRITICAL(&s_wifi_ipinfo_lock);
+            enable_napt_on_sta();
+            set_usb_ip_from_wifi(&ipinfo);
+        }
+    }
+}
+#endif
+
+/* App loop: sleeps until an event bit is set (or the stats period elapses) */
+static void app_event_loop(void)
+{
+    TickType_t last_stats = xTaskGetTickCount();
+    for (;;) {
+        EventBits_t bits = xEventGroupWaitBits(s_app_events, APP_EV_LOOP, pdTRUE, pdFALSE,
+                                               pdMS_TO_TICKS(APP_STATS_PERIOD_MS));
+#if CONFIG_DONGLE_USB_LINK_FOLLOWS_WIFI
+        if (bits & (APP_EV_WIFI_CONNECTED | APP_EV_WIFI_DISCONNECTED)) {
+            usb_link_update(); /* before the reconnect back-off */
+        }
+#endif
+        if (bits & APP_EV_WIFI_DISCONNECTED) {
+            vTaskDelay(pdMS_TO_TICKS(500));
+            esp_wifi_connect();
+        }
+#if CONFIG_DONGLE_FORWARD_L2_BRIDGE
+        /* bridged: the host talks to the upstream DHCP server, no NAPT or address following */
+        if (bits & APP_EV_USB_NET_INIT) {
+            l2_bridge_flush(); /* possibly a different host */
+        }
+#endif
+        if (xTaskGetTickCount() - last_stats >= pdMS_TO_TICKS(APP_STATS_PERIOD_MS)) {
+            last_stats = xTaskGetTickCount();
+#if CONFIG_DONGLE_USB_LINK_FOLLOWS_WIFI
+            usb_link_update(); /* rate class follows the RSSI */
+#endif
+            rx_log_drop_stats();
+            tx_log_drop_stats();
+#if CFG_TUD_NCM
+            ncm_rx_log_stats();
+#endif
+#if CFG_TUD_ECM_RNDIS
+            ecm_rndis_log_stats();
+#endif
+#if CFG_TUD_NCM && CONFIG_DONGLE_NCM_TX_HOLDOFF_US > 0
+            ncm_tx_log_stats();
+#endif
+#if CONFIG_DONGLE_FORWARD_L2_BRIDGE
+            l2_bridge_log_stats();
+#elif CONFIG_DONGLE_NAPT_FASTPATH
+            napt_fastpath_log_stats();
+#endif
+#if CONFIG_DONGLE_TCP_MSS_CLAMP
+            mss_clamp_log_stats();
+#endif
+        }
+    }
 }
 
 /* initialize WiFi STA */
@@ -636,13 +1583,25 @@ void app_main(void)
 
     ESP_LOGI(TAG, "Starting USB WiFi dongle");
 
+    s_app_events = xEventGroupCreate();
+    if (!s_app_events) {
+        ESP_LOGE(TAG, "Failed to create app event group");
+        return;
+    }
+
     init_wifi_sta();
+    topology_apply_tcpip();
 
     tinyusb_init_and_create_usb_netif();
+    topology_self_check();
 
-    /* main loop: run TinyUSB core (and let TinyUSB callbacks/tasks do network work) */
-    while (1) {
-        tud_task();      // TinyUSB core processing
-        vTaskDelay(pdMS_TO_TICKS(10));
+#if !CONFIG_DONGLE_FORWARD_L2_BRIDGE
+    /* bits set before it runs are kept: a host that attached early is still served */
+    if (xTaskCreate(usb_ip_task, "usb_ip", 4096, NULL, uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create usb_ip task");
     }
+#endif
+
+    /* TinyUSB runs in its own task (esp_tinyusb); everything else here is event driven */
+    app_event_loop();
 }
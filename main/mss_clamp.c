@@ -0,0 +1,97 @@
+/* mss_clamp.c
+ * TCP MSS clamping (see mss_clamp.h).
+ */
+
+#include <string.h>
+#include <stdatomic.h>
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "net_csum.h"
+#include "mss_clamp.h"
+
+static const char *TAG = "mss_clamp";
+
+#define ETH_HDR_LEN     14
+#define ETHTYPE_IPV4    0x0800
+#define IP_PROTO_TCP    6
+#define TCP_SYN         0x02
+#define TCPOPT_EOL      0
+#define TCPOPT_NOP      1
+#define TCPOPT_MSS      2
+
+static atomic_uint s_clamped[MSS_CLAMP_DIR_MAX];
+
+static inline uint16_t rd16(const uint8_t *p) { return (uint16_t)((p[0] << 8) | p[1]); }
+static inline void wr16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v & 0xFF; }
+
+/* Offset of the MSS option to rewrite within the TCP header, 0 if the frame is left alone */
+static uint16_t mss_option(const uint8_t *frame, uint16_t len, mss_clamp_dir_t dir, uint32_t local_ip)
+{
+    /* Ethernet + minimal IPv4 + TCP header with at least one option word */
+    if (len < ETH_HDR_LEN + 20 + 24 || rd16(frame + 12) != ETHTYPE_IPV4) return 0;
+    const uint8_t *ip = frame + ETH_HDR_LEN;
+    uint16_t ihl = (ip[0] & 0x0F) * 4;
+    if ((ip[0] >> 4) != 4 || ihl < 20 || ip[9] != IP_PROTO_TCP) return 0;
+    if (rd16(ip + 6) & 0x1FFF) return 0; /* not the first fragment */
+    if (local_ip) {
+        /* terminated by the dongle itself: not forwarded */
+        uint32_t addr;
+        memcpy(&addr, ip + (dir == MSS_CLAMP_USB_TO_WIFI ? 16 : 12), sizeof(addr));
+        if (addr == local_ip) return 0;
+    }
+
+    const uint8_t *tcp = ip + ihl;
+    if (tcp + 20 > frame + len || !(tcp[13] & TCP_SYN)) return 0;
+    uint16_t thl = (tcp[12] >> 4) * 4;
+    if (thl <= 20 || tcp + thl > frame + len) return 0;
+
+    for (uint16_t o = 20; o < thl; ) {
+        uint8_t kind = tcp[o];
+        if (kind == TCPOPT_EOL) break;
+        if (kind == TCPOPT_NOP) { o++; continue; }
+        if (o + 1 >= thl || tcp[o + 1] < 2 || o + tcp[o + 1] > thl) break; /* malformed */
+        if (kind == TCPOPT_MSS && tcp[o + 1] == 4) {
+            return rd16(tcp + o + 2) > CONFIG_DONGLE_TCP_MSS_CLAMP_VALUE ? o : 0;
+        }
+        o += tcp[o + 1];
+    }
+    return 0;
+}
+
+bool mss_clamp_needed(const uint8_t *frame, uint16_t len, mss_clamp_dir_t dir, uint32_t local_ip)
+{
+    return mss_option(frame, len, dir, local_ip) != 0;
+}
+
+bool mss_clamp_frame(uint8_t *frame, uint16_t len, mss_clamp_dir_t dir, uint32_t local_ip)
+{
+    uint16_t o = mss_option(frame, len, dir, local_ip);
+    if (!o) return false;
+    uint8_t *tcp = frame + ETH_HDR_LEN + (frame[ETH_HDR_LEN] & 0x0F) * 4;
+
+    /* The value may straddle two checksum words (odd option offset): build the delta
+       over the aligned words that cover it. */
+    uint16_t w = (o + 2) & ~1u;
+    uint16_t words = ((o + 2) & 1) ? 2 : 1;
+    uint8_t old_span[4];
+    memcpy(old_span, tcp + w, words * 2);
+    wr16(tcp + o + 2, CONFIG_DONGLE_TCP_MSS_CLAMP_VALUE);
+    uint32_t delta = net_csum_delta(old_span, tcp + w, words);
+    wr16(tcp + 16, net_csum_apply(rd16(tcp + 16), delta));
+    atomic_fetch_add(&s_clamped[dir], 1);
+    return true;
+}
+
+void mss_clamp_log_stats(void)
+{
+    static unsigned last_up, last_down;
+    unsigned up = atomic_load(&s_clamped[MSS_CLAMP_USB_TO_WIFI]);
+    unsigned down = atomic_load(&s_clamped[MSS_CLAMP_WIFI_TO_USB]);
+    if (up == last_up && down == last_down) return;
+    ESP_LOGI(TAG, "MSS clamped to %d: usb->wifi=%u wifi->usb=%u",
+             CONFIG_DONGLE_TCP_MSS_CLAMP_VALUE, up, down);
+    last_up = up;
+    last_down = down;
+}
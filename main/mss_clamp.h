@@ -0,0 +1,38 @@
+/* mss_clamp.h
+ * TCP MSS clamping for SYN / SYN-ACK segments crossing between the USB netif and the WiFi STA.
+ *
+ * The host derives its MSS from the USB link MTU (1514-byte frames); an upstream path with a
+ * smaller MTU (PPPoE, tunnels) then relies on fragmentation or PMTU discovery. Lowering the
+ * MSS option in both handshake directions keeps every segment within the upstream MTU.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    MSS_CLAMP_USB_TO_WIFI,  /* host SYNs: limits what the remote side sends */
+    MSS_CLAMP_WIFI_TO_USB,  /* SYN-ACKs (and SYNs) towards the host: limits what the host sends */
+    MSS_CLAMP_DIR_MAX
+} mss_clamp_dir_t;
+
+/* True if mss_clamp_frame() would rewrite the frame: an Ethernet/IPv4/TCP SYN with an MSS option
+   above the limit, forwarded across the dongle. local_ip (network order, 0 for none) is the
+   dongle's own USB address; handshakes it terminates (destination for USB_TO_WIFI, source for
+   WIFI_TO_USB) are not clamped. */
+bool mss_clamp_needed(const uint8_t *frame, uint16_t len, mss_clamp_dir_t dir, uint32_t local_ip);
+
+/* Clamp the MSS option of such a frame in place (checksum patched incrementally). Returns true if
+   the frame was rewritten. Any other frame is left untouched. */
+bool mss_clamp_frame(uint8_t *frame, uint16_t len, mss_clamp_dir_t dir, uint32_t local_ip);
+
+/* Log per-direction rewrite counters if they moved since the last call */
+void mss_clamp_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
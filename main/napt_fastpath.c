@@ -0,0 +1,387 @@
+/* napt_fastpath.c
+ * NAPT flow cache (see napt_fastpath.h).
+ *
+ * Learning: a host packet that misses the cache leaves a "pending" record keyed by what NAPT
+ *   does not change (protocol, remote address/port, IP ID, TCP sequence / IP length). When the
+ *   translated packet reaches the STA netif linkoutput, the record is matched and a flow is
+ *   installed with the NAT port, STA/gateway MACs and precomputed checksum deltas.
+ * Expiry: the fast path does not refresh lwIP's NAPT entry, so a flow only lives for
+ *   CONFIG_DONGLE_NAPT_FASTPATH_REFRESH_MS. The next packet then takes the slow path again,
+ *   which refreshes the NAPT entry and re-learns the flow; a flow can therefore never outlive
+ *   its NAPT mapping. TCP SYN/FIN/RST always take the slow path and drop the flow.
+ */
+
+#include <string.h>
+#include <stdatomic.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "esp_private/wifi.h" // esp_wifi_internal_tx, esp_wifi_internal_reg_rxcb
+#include "esp_netif_net_stack.h" // esp_netif_get_netif_impl
+
+#include "lwip/netif.h"
+
+#include "net_csum.h"
+#include "napt_fastpath.h"
+
+static const char *TAG = "napt_fp";
+
+#define FP_FLOWS      CONFIG_DONGLE_NAPT_FASTPATH_FLOWS
+#define FP_MASK       (FP_FLOWS - 1)
+_Static_assert((FP_FLOWS & FP_MASK) == 0, "CONFIG_DONGLE_NAPT_FASTPATH_FLOWS must be a power of two");
+#define FP_PENDING_MS 1000
+
+#define ETH_HDR_LEN   14
+#define ETH_ADDR_LEN  6
+#define ETHTYPE_IPV4  0x0800
+#define IP_HDR_LEN    20
+#define IP_PROTO_TCP  6
+#define IP_PROTO_UDP  17
+#define TCP_FIN       0x01
+#define TCP_SYN       0x02
+#define TCP_RST       0x04
+#define TCP_ACK       0x10
+#define FP_MAX_FRAME  1536
+
+/* addresses and ports are kept as raw network-order bytes */
+typedef struct {
+    bool used;
+    uint8_t proto;
+    uint8_t host_ip[4], remote_ip[4], sta_ip[4];
+    uint8_t host_port[2], remote_port[2], nat_port[2];
+    uint8_t host_mac[ETH_ADDR_LEN], usb_mac[ETH_ADDR_LEN];   /* USB side: host and dongle MAC */
+    uint8_t sta_mac[ETH_ADDR_LEN], gw_mac[ETH_ADDR_LEN];     /* WiFi side: STA and next hop MAC */
+    uint32_t ip_up_delta, l4_up_delta;      /* one's complement deltas host -> STA address/port */
+    uint32_t ip_down_delta, l4_down_delta;  /* and back */
+    TickType_t expires;
+} fp_flow_t;
+
+typedef struct {
+    bool used;
+    uint8_t proto;
+    uint8_t remote_ip[4], remote_port[2], ip_id[2], tag[4]; /* tag: TCP seq, else IP length + ID */
+    uint8_t host_ip[4], host_port[2];
+    uint8_t host_mac[ETH_ADDR_LEN], usb_mac[ETH_ADDR_LEN];
+    TickType_t expires;
+} fp_pending_t;
+
+/* parsed IPv4 TCP/UDP frame */
+typedef struct {
+    uint8_t *eth, *ip, *l4;
+    uint8_t proto;
+    uint8_t tcp_flags;
+} fp_pkt_t;
+
+static esp_netif_t *s_sta_netif;
+static napt_fastpath_usb_tx_fn s_usb_tx;
+static netif_linkoutput_fn s_sta_linkoutput; /* original STA linkoutput */
+
+static fp_flow_t s_flows[FP_FLOWS];           /* direct mapped by the uplink key */
+static uint16_t s_down_idx[FP_FLOWS];         /* downlink key -> flow index + 1 (validated) */
+static fp_pending_t s_pending[FP_FLOWS];
+static portMUX_TYPE s_fp_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* uplink scratch buffer, TinyUSB task only */
+static uint8_t s_up_buf[FP_MAX_FRAME];
+
+static atomic_uint s_up_fast, s_down_fast, s_learned, s_evicted, s_drop;
+
+static inline uint16_t rd16(const uint8_t *p) { return (uint16_t)((p[0] << 8) | p[1]); }
+static inline void wr16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v & 0xFF; }
+
+/* ---------------- parsing ---------------- */
+static bool fp_parse(uint8_t *frame, uint16_t len, fp_pkt_t *pk)
+{
+    if (len < ETH_HDR_LEN + IP_HDR_LEN || rd16(frame + 12) != ETHTYPE_IPV4) return false;
+    uint8_t *ip = frame + ETH_HDR_LEN;
+    if (ip[0] != 0x45) return false;                 /* IPv4 without options */
+    if (rd16(ip + 6) & 0x3FFF) return false;         /* fragments */
+    if (rd16(ip + 2) > len - ETH_HDR_LEN) return false;
+    pk->eth = frame;
+    pk->ip = ip;
+    pk->l4 = ip + IP_HDR_LEN;
+    pk->proto = ip[9];
+    pk->tcp_flags = 0;
+    if (pk->proto == IP_PROTO_TCP) {
+        if (len < ETH_HDR_LEN + IP_HDR_LEN + 20) return false;
+        pk->tcp_flags = pk->l4[13];
+        return true;
+    }
+    return pk->proto == IP_PROTO_UDP && len >= ETH_HDR_LEN + IP_HDR_LEN + 8;
+}
+
+static inline bool fp_tcp_established(const fp_pkt_t *pk)
+{
+    return pk->proto != IP_PROTO_TCP ||
+           (pk->tcp_flags & (TCP_SYN | TCP_FIN | TCP_RST | TCP_ACK)) == TCP_ACK;
+}
+
+static inline uint16_t fp_l4_csum_off(uint8_t proto)
+{
+    return proto == IP_PROTO_TCP ? 16 : 6;
+}
+
+static uint32_t fp_hash(uint8_t proto, const uint8_t *ip, const uint8_t *port_a, const uint8_t *port_b)
+{
+    uint32_t h = ((uint32_t)ip[0] << 24 | (uint32_t)ip[1] << 16 | (uint32_t)ip[2] << 8 | ip[3]);
+    h ^= (uint32_t)rd16(port_a) << 16 | rd16(port_b);
+    h ^= proto;
+    h *= 0x9E3779B1u;
+    return h >> 16;
+}
+
+/* uplink key: host port, remote address and port */
+static inline uint32_t fp_up_slot(uint8_t proto, const uint8_t *remote_ip, const uint8_t *host_port,
+                                  const uint8_t *remote_port)
+{
+    return fp_hash(proto, remote_ip, host_port, remote_port) & FP_MASK;
+}
+
+/* downlink key: NAT port, remote address and port */
+static inline uint32_t fp_down_slot(uint8_t proto, const uint8_t *remote_ip, const uint8_t *nat_port,
+                                    const uint8_t *remote_port)
+{
+    return fp_hash(proto, remote_ip, nat_port, remote_port) & FP_MASK;
+}
+
+/* Rewrite one address/port pair, decrement TTL and patch both checksums */
+static void fp_rewrite(const fp_pkt_t *pk, uint8_t *ip_field, const uint8_t *new_ip,
+                       uint8_t *port_field, const uint8_t *new_port, uint32_t ip_delta, uint32_t l4_delta)
+{
+    uint8_t *ip = pk->ip;
+    memcpy(ip_field, new_ip, 4);
+    memcpy(port_field, new_port, 2);
+    wr16(ip + 10, net_csum_apply(rd16(ip + 10), ip_delta));
+    net_csum_ipv4_dec_ttl(ip);
+
+    uint8_t *csum = pk->l4 + fp_l4_csum_off(pk->proto);
+    if (pk->proto == IP_PROTO_UDP) {
+        wr16(csum, net_csum_apply_udp(rd16(csum), l4_delta));
+    } else {
+        wr16(csum, net_csum_apply(rd16(csum), l4_delta));
+    }
+}
+
+/* ---------------- uplink: host -> WiFi ---------------- */
+static void fp_note_pending(const fp_pkt_t *pk)
+{
+    const uint8_t *tag = pk->proto == IP_PROTO_TCP ? pk->l4 + 4 : pk->ip + 2;
+    uint32_t slot = fp_hash(pk->proto, pk->ip + 16, pk->l4 + 2, pk->ip + 4) & FP_MASK;
+    TickType_t now = xTaskGetTickCount();
+    taskENTER_CRITICAL(&s_fp_lock);
+    fp_pending_t *pe = &s_pending[slot];
+    pe->used = true;
+    pe->proto = pk->proto;
+    memcpy(pe->remote_ip, pk->ip + 16, 4);
+    memcpy(pe->remote_port, pk->l4 + 2, 2);
+    memcpy(pe->ip_id, pk->ip + 4, 2);
+    memcpy(pe->tag, tag, 4);
+    memcpy(pe->host_ip, pk->ip + 12, 4);
+    memcpy(pe->host_port, pk->l4, 2);
+    memcpy(pe->host_mac, pk->eth + ETH_ADDR_LEN, ETH_ADDR_LEN);
+    memcpy(pe->usb_mac, pk->eth, ETH_ADDR_LEN);
+    pe->expires = now + pdMS_TO_TICKS(FP_PENDING_MS);
+    taskEXIT_CRITICAL(&s_fp_lock);
+}
+
+bool napt_fastpath_from_usb(const uint8_t *frame, uint16_t len)
+{
+    if (len > sizeof(s_up_buf) || len < ETH_HDR_LEN + IP_HDR_LEN) return false;
+    /* cheap pre-check on the const frame before copying anything */
+    if (rd16(frame + 12) != ETHTYPE_IPV4) return false;
+
+    fp_pkt_t pk;
+    if (!fp_parse((uint8_t*)frame, len, &pk)) return false;
+
+    uint32_t slot = fp_up_slot(pk.proto, pk.ip + 16, pk.l4, pk.l4 + 2);
+    fp_flow_t fl;
+    bool hit = false;
+    TickType_t now = xTaskGetTickCount();
+    taskENTER_CRITICAL(&s_fp_lock);
+    fp_flow_t *f = &s_flows[slot];
+    if (f->used && f->proto == pk.proto &&
+        memcmp(f->remote_ip, pk.ip + 16, 4) == 0 && memcmp(f->remote_port, pk.l4 + 2, 2) == 0 &&
+        memcmp(f->host_ip, pk.ip + 12, 4) == 0 && memcmp(f->host_port, pk.l4, 2) == 0 &&
+        memcmp(f->usb_mac, pk.eth, ETH_ADDR_LEN) == 0) {
+        if (!fp_tcp_established(&pk) || (int32_t)(now - f->expires) >= 0) {
+            f->used = false; /* closing or due for a NAPT refresh: back to the slow path */
+            atomic_fetch_add(&s_evicted, 1);
+        } else {
+            fl = *f;
+            hit = true;
+        }
+    }
+    taskEXIT_CRITICAL(&s_fp_lock);
+
+    if (!hit) {
+        if (fp_tcp_established(&pk)) fp_note_pending(&pk);
+        return false;
+    }
+    if (pk.ip[8] <= 1) return false; /* let lwIP send the ICMP time exceeded */
+
+    /* frame belongs to the USB driver: rewrite a copy */
+    memcpy(s_up_buf, frame, len);
+    fp_parse(s_up_buf, len, &pk);
+    fp_rewrite(&pk, pk.ip + 12, fl.sta_ip, pk.l4, fl.nat_port, fl.ip_up_delta, fl.l4_up_delta);
+    memcpy(pk.eth, fl.gw_mac, ETH_ADDR_LEN);
+    memcpy(pk.eth + ETH_ADDR_LEN, fl.sta_mac, ETH_ADDR_LEN);
+    if (esp_wifi_internal_tx(WIFI_IF_STA, s_up_buf, len) == ESP_OK) {
+        atomic_fetch_add(&s_up_fast, 1);
+    } else {
+        atomic_fetch_add(&s_drop, 1);
+    }
+    return true;
+}
+
+/* ---------------- learning: translated packet leaving the STA netif ---------------- */
+static void fp_learn(struct pbuf *p)
+{
+    if (p->len < ETH_HDR_LEN + IP_HDR_LEN + 8) return;
+    fp_pkt_t pk;
+    if (!fp_parse(p->payload, p->len, &pk) || !fp_tcp_established(&pk)) return;
+
+    const uint8_t *tag = pk.proto == IP_PROTO_TCP ? pk.l4 + 4 : pk.ip + 2;
+    uint32_t pslot = fp_hash(pk.proto, pk.ip + 16, pk.l4 + 2, pk.ip + 4) & FP_MASK;
+    TickType_t now = xTaskGetTickCount();
+
+    taskENTER_CRITICAL(&s_fp_lock);
+    fp_pending_t *pe = &s_pending[pslot];
+    if (!pe->used || pe->proto != pk.proto || (int32_t)(now - pe->expires) >= 0 ||
+        memcmp(pe->remote_ip, pk.ip + 16, 4) || memcmp(pe->remote_port, pk.l4 + 2, 2) ||
+        memcmp(pe->ip_id, pk.ip + 4, 2) || memcmp(pe->tag, tag, 4)) {
+        taskEXIT_CRITICAL(&s_fp_lock);
+        return;
+    }
+    pe->used = false;
+
+    uint32_t slot = fp_up_slot(pk.proto, pk.ip + 16, pe->host_port, pk.l4 + 2);
+    fp_flow_t *f = &s_flows[slot];
+    if (f->used) atomic_fetch_add(&s_evicted, 1);
+    f->used = true;
+    f->proto = pk.proto;
+    memcpy(f->host_ip, pe->host_ip, 4);
+    memcpy(f->host_port, pe->host_port, 2);
+    memcpy(f->host_mac, pe->host_mac, ETH_ADDR_LEN);
+    memcpy(f->usb_mac, pe->usb_mac, ETH_ADDR_LEN);
+    memcpy(f->remote_ip, pk.ip + 16, 4);
+    memcpy(f->remote_port, pk.l4 + 2, 2);
+    memcpy(f->sta_ip, pk.ip + 12, 4);
+    memcpy(f->nat_port, pk.l4, 2);
+    memcpy(f->gw_mac, pk.eth, ETH_ADDR_LEN);
+    memcpy(f->sta_mac, pk.eth + ETH_ADDR_LEN, ETH_ADDR_LEN);
+    f->ip_up_delta = net_csum_delta(f->host_ip, f->sta_ip, 2);
+    f->l4_up_delta = f->ip_up_delta + net_csum_delta(f->host_port, f->nat_port, 1);
+    f->ip_down_delta = net_csum_delta(f->sta_ip, f->host_ip, 2);
+    f->l4_down_delta = f->ip_down_delta + net_csum_delta(f->nat_port, f->host_port, 1);
+    f->expires = now + pdMS_TO_TICKS(CONFIG_DONGLE_NAPT_FASTPATH_REFRESH_MS);
+    s_down_idx[fp_down_slot(pk.proto, f->remote_ip, f->nat_port, f->remote_port)] = (uint16_t)(slot + 1);
+    taskEXIT_CRITICAL(&s_fp_lock);
+    atomic_fetch_add(&s_learned, 1);
+}
+
+/* Wraps the STA netif linkoutput (tcpip thread) */
+static err_t fp_sta_linkoutput(struct netif *netif, struct pbuf *p)
+{
+    fp_learn(p);
+    return s_sta_linkoutput(netif, p);
+}
+
+/* ---------------- downlink: WiFi -> host ---------------- */
+static esp_err_t fp_wifi_rx(void *buffer, uint16_t len, void *eb)
+{
+    fp_pkt_t pk;
+    if (!fp_parse(buffer, len, &pk) || (pk.eth[0] & 1)) {
+        return esp_netif_receive(s_sta_netif, buffer, len, eb);
+    }
+
+    uint32_t slot = fp_down_slot(pk.proto, pk.ip + 12, pk.l4 + 2, pk.l4);
+    fp_flow_t fl;
+    bool hit = false;
+    TickType_t now = xTaskGetTickCount();
+    taskENTER_CRITICAL(&s_fp_lock);
+    uint16_t idx = s_down_idx[slot];
+    fp_flow_t *f = idx ? &s_flows[idx - 1] : NULL;
+    if (f && f->used && f->proto == pk.proto &&
+        memcmp(f->remote_ip, pk.ip + 12, 4) == 0 && memcmp(f->remote_port, pk.l4, 2) == 0 &&
+        memcmp(f->sta_ip, pk.ip + 16, 4) == 0 && memcmp(f->nat_port, pk.l4 + 2, 2) == 0) {
+        if (!fp_tcp_established(&pk) || (int32_t)(now - f->expires) >= 0) {
+            f->used = false;
+            atomic_fetch_add(&s_evicted, 1);
+        } else {
+            fl = *f;
+            hit = true;
+        }
+    }
+    taskEXIT_CRITICAL(&s_fp_lock);
+
+    if (!hit || pk.ip[8] <= 1) {
+        return esp_netif_receive(s_sta_netif, buffer, len, eb);
+    }
+
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, len, PBUF_RAM);
+    if (!p) {
+        atomic_fetch_add(&s_drop, 1);
+        esp_wifi_internal_free_rx_buffer(eb);
+        return ESP_OK;
+    }
+    memcpy(p->payload, buffer, len);
+    esp_wifi_internal_free_rx_buffer(eb);
+
+    fp_parse(p->payload, len, &pk);
+    fp_rewrite(&pk, pk.ip + 16, fl.host_ip, pk.l4 + 2, fl.host_port, fl.ip_down_delta, fl.l4_down_delta);
+    memcpy(pk.eth, fl.host_mac, ETH_ADDR_LEN);
+    memcpy(pk.eth + ETH_ADDR_LEN, fl.usb_mac, ETH_ADDR_LEN);
+    if (s_usb_tx(p) == ESP_OK) {
+        atomic_fetch_add(&s_down_fast, 1);
+    } else {
+        atomic_fetch_add(&s_drop, 1);
+    }
+    return ESP_OK;
+}
+
+/* ---------------- setup ---------------- */
+esp_err_t napt_fastpath_init(esp_netif_t *sta_netif, napt_fastpath_usb_tx_fn usb_tx)
+{
+    if (!sta_netif || !usb_tx) return ESP_ERR_INVALID_ARG;
+    s_sta_netif = sta_netif;
+    s_usb_tx = usb_tx;
+    napt_fastpath_flush();
+    return ESP_OK;
+}
+
+esp_err_t napt_fastpath_attach_wifi(void)
+{
+    if (!s_sta_netif) return ESP_ERR_INVALID_STATE;
+    struct netif *lw = esp_netif_get_netif_impl(s_sta_netif);
+    if (!lw || !lw->linkoutput) return ESP_ERR_INVALID_STATE;
+    if (lw->linkoutput != fp_sta_linkoutput) {
+        s_sta_linkoutput = lw->linkoutput;
+        lw->linkoutput = fp_sta_linkoutput;
+    }
+    return esp_wifi_internal_reg_rxcb(WIFI_IF_STA, fp_wifi_rx);
+}
+
+void napt_fastpath_flush(void)
+{
+    taskENTER_CRITICAL(&s_fp_lock);
+    memset(s_flows, 0, sizeof(s_flows));
+    memset(s_down_idx, 0, sizeof(s_down_idx));
+    memset(s_pending, 0, sizeof(s_pending));
+    taskEXIT_CRITICAL(&s_fp_lock);
+}
+
+void napt_fastpath_log_stats(void)
+{
+    static unsigned last_up, last_down, last_learned;
+    unsigned up = atomic_load(&s_up_fast), down = atomic_load(&s_down_fast);
+    unsigned learned = atomic_load(&s_learned);
+    if (up == last_up && down == last_down && learned == last_learned) return;
+    ESP_LOGI(TAG, "fast path: up=%u down=%u learned=%u evicted=%u drop=%u",
+             up, down, learned, atomic_load(&s_evicted), atomic_load(&s_drop));
+    last_up = up;
+    last_down = down;
+    last_learned = learned;
+}
@@ -0,0 +1,44 @@
+/* napt_fastpath.h
+ * Per-flow fast path for NAPT forwarding between the USB netif and the WiFi STA.
+ *
+ * Established TCP/UDP flows are learned by correlating a host packet that took the normal
+ * lwIP route (ip4_forward + NAPT) with the translated copy leaving the STA netif. Later
+ * packets of the flow are rewritten in place (address, port, TTL, incremental checksums)
+ * and sent directly from tud_network_recv_cb / the STA RX callback without the tcpip thread.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_netif.h"
+#include "lwip/pbuf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Queue a frame towards the USB host. Takes ownership of p (one reference). */
+typedef esp_err_t (*napt_fastpath_usb_tx_fn)(struct pbuf *p);
+
+/* Call once before traffic flows */
+esp_err_t napt_fastpath_init(esp_netif_t *sta_netif, napt_fastpath_usb_tx_fn usb_tx);
+
+/* Hook the STA RX callback and the STA netif output. Must run after esp-netif registered its
+   own RX callback, i.e. from the WIFI_EVENT_STA_CONNECTED handler. */
+esp_err_t napt_fastpath_attach_wifi(void);
+
+/* TinyUSB task: frame from the host. Returns true if it was sent on the fast path, false if it
+   has to take the normal lwIP route. frame is not modified. */
+bool napt_fastpath_from_usb(const uint8_t *frame, uint16_t len);
+
+/* Drop every cached flow (addresses changed, link lost) */
+void napt_fastpath_flush(void);
+
+/* Log fast path counters if any of them moved since the last call */
+void napt_fastpath_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
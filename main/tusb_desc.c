@@ -21,6 +21,28 @@ const tusb_desc_device_t desc_device =
     .bNumConfigurations = 0x01
 };
 
+#if CFG_TUD_NCM
+/* Full-speed configuration descriptor: CDC-NCM, one configuration, data interface with an
+   inactive (alt 0) and an active (alt 1) setting as required by the NCM spec.
+   String index 4 is the host-side MAC address (see tusb_strings in main.c). */
+enum {
+    ITF_NUM_NCM_COMM = 0,
+    ITF_NUM_NCM_DATA,
+    ITF_NUM_TOTAL
+};
+
+#define EP_NCM_NOTIF        0x81
+#define EP_NCM_OUT          0x02
+#define EP_NCM_IN           0x82
+#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_NCM_DESC_LEN)
+
+const uint8_t desc_fs_configuration[] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0, 100),
+    /* notification endpoint must hold a CONNECTION_SPEED_CHANGE notification (16 bytes) */
+    TUD_CDC_NCM_DESCRIPTOR(ITF_NUM_NCM_COMM, 0, 4, EP_NCM_NOTIF, 64, EP_NCM_OUT, EP_NCM_IN,
+                           CFG_TUD_NET_ENDPOINT_SIZE, CFG_TUD_NET_MTU),
+};
+#else
 /* Full-speed configuration descriptor (raw ECM descriptor bytes).
    IMPORTANT: wTotalLength set to 79 (0x4F) matching descriptor bytes below.
 */
@@ -57,7 +79,7 @@ const uint8_t desc_fs_configuration[] = {
     4,                  /* iMACAddress string index = 4 */
     0x00,0x00,0x00,0x00,/* bmEthernetStatistics (4 bytes) */
     0xEA,0x05,          /* wMaxSegmentSize = 1514 (0x05EA) little-endian */
-    0x00,0x00,          /* wNumberMCFilters */
+    U16_TO_U8S_LE(TUD_NET_MC_FILTERS_DESC), /* wNumberMCFilters */
     0x00,               /* bNumberPowerFilters */
 
     /* Notification Endpoint (Interrupt IN) */
@@ -77,4 +99,5 @@ const uint8_t desc_fs_configuration[] = {
     /* Endpoint IN (Bulk IN) */
     7, TUSB_DESC_ENDPOINT,
     0x82, 0x02, 0x40, 0x00, 0
-};
\ No newline at end of file
+};
+#endif /* CFG_TUD_NCM */